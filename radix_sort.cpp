@@ -105,11 +105,19 @@
 #include <algorithm>
 #include <array>
 #include <assert.h>
+#include <chrono>
 #include <ctype.h>
 #include <limits.h>
+#include <limits>
+#include <memory>
 #include <numeric>
 #include <random>
+#if __has_include(<span>)
+#include <span>
+#endif
+#include <stdexcept>
 #include <stdio.h>
+#include <string>
 #include <string.h>
 #include <time.h>
 #include <vector>
@@ -117,6 +125,7 @@
 #define NOMINMAX
 #include <windows.h>
 #else
+#include <sys/resource.h>
 #include <unistd.h>
 #endif
 
@@ -126,268 +135,2391 @@
 // and base is complex and some combinations do not work,
 // e.g. divide by zero.
 //
-// Negative numbers support is experimental/optional.
-// This class could be stateless and a template function would suffice.
+// Negative numbers are sorted by flipping the sign bit, see SignFlipKey.
+// This class could be stateless and a template function would suffice,
+// except that it keeps scratch memory between sorts, see arena.
+//
+// Projection picks the key out of each T, so structs can be sorted by
+// a member, without a separate array of keys, e.g.
+//   RadixSorter<Order, 256, decltype(&Order::timestamp)> sort(&Order::timestamp);
+// The default, Identity, sorts T itself.
 //
+#include "radix_sort_common.h"
+#include "radix_sort_dispatch.h"
+#include "radix_sort_histogram.h"
+#include "radix_sort_stats.h"
+#include "radix_sort_thread_pool.h"
 #include "radix_sort_chatgpt.cpp"
+#include "radix_sort_string.cpp"
 
-template <typename T, int64_t Base>
+template <typename T, int64_t Base, typename Projection = Identity>
 class RadixSorter
 {
 public:
+    RadixSorter(Projection projection = Projection())
+        : key(typename Key::Key(), projection)
+    {
+    }
+
     bool chatGpt = false;
-    bool handleNegativeNumbers = false;
 
+    // Sort without the O(n) temporary, by permuting elements within
+    // their buckets ("American flag sort"). Extra storage is only
+    // the counts and positions per recursion level, O(Base * max_digits).
+    // This mode is not stable, which does not matter for plain values.
+    bool inPlace = false;
+
+    // Statistic: how many scatters the last sort skipped, because every
+    // element had the same digit. For chatGpt these are whole passes.
+    // For the recursive sorts these are per-bucket, i.e. partial passes.
+    std::atomic<size_t> skippedPasses{0};
+
+    // Sort buckets in parallel, on ThreadPool::instance().
+    // After the first digit, each bucket is an independent problem over
+    // disjoint ranges of data and temp. Buckets of at least parallelThreshold
+    // elements become tasks, smaller ones are sorted inline by whichever
+    // thread found them. The first digit of a large input is itself split
+    // into chunks, each counted and scattered by one thread. Chunks are
+    // placed in order within each bucket, so the result is stable and
+    // identical to the serial sort.
+    // With chatGpt, parallel_radix_sort is used, each pass split
+    // into chunks of at least parallelThreshold elements.
+    bool parallel = false;
+    size_t parallelThreshold = 1 << 16;
+
+    // Large scatters stage elements a cache line per bucket, and write whole
+    // lines, with non-temporal stores for LSD passes larger than the last
+    // level cache. See scatter.
+    ScatterOptions scatterOptions;
+
+    // Buckets this small are finished with insertion sort instead of
+    // recursing. A histogram costs zeroing and summing Base counters,
+    // which dwarfs sorting a few elements. Insertion sort is stable.
+    // 0 disables it. The default is from Benchmark, see default_insertion_sort_threshold.
+    size_t insertionSortThreshold = default_insertion_sort_threshold();
+
+    static constexpr size_t default_insertion_sort_threshold()
+    {
+        // Larger bases have larger histograms, so tolerate larger buckets.
+        // Benchmark of 1e6 and 1e7 random ints found the best around
+        // 16-32 for base 4, 32-48 for base 16, and 48-128 for base 256.
+        return (Base >= 256) ? 64 : (Base >= 16) ? 32 : 24;
+    }
+
+    // Temporaries come from arena, which keeps its memory between sorts,
+    // so sorting often does not allocate, or zero, every time. See ScratchArena,
+    // and its trimThreshold, which limits what it keeps.
+    // With threadArena, ScratchArena::thread_default() is used instead,
+    // shared by every RadixSorter on the thread.
+    ScratchArena arena;
+    bool threadArena = false;
+
+    // Return a sorted copy of [begin, end).
+    // From pointers and vectors, the copy is made by sort_to, in the pass
+    // that finds the key statistics, so the input is read once before sorting.
     template <typename Iterator>
     std::vector<T> operator()(Iterator begin, Iterator end)
     {
-        std::vector<T> copy(begin, end);
+        if constexpr (std::is_same_v<Iterator, T*> || std::is_same_v<Iterator, T const*> ||
+            std::is_same_v<Iterator, typename std::vector<T>::iterator> ||
+            std::is_same_v<Iterator, typename std::vector<T>::const_iterator>)
+        {
+            std::vector<T> sorted(end - begin);
+            if (begin != end)
+                sort_to(&*begin, sorted.size(), sorted.data());
+            return sorted;
+        }
+        else
+        {
+            std::vector<T> copy(begin, end);
+            sort(copy.data(), copy.size());
+            return copy;
+        }
+    }
+
+    // Sort data, leaving the result in data.
+    // scratch, if not null, is size elements, whose contents are not used,
+    // else scratch comes from the arena.
+    // The sort puts the result in data, by its choice of where each level
+    // goes, instead of a copy back at the end.
+    // With inPlace, scratch is not needed.
+    void sort(T* data, size_t size, T* scratch = nullptr)
+    {
+        skippedPasses = 0;
+
+        if (size < 2)
+            return;
 
         if (chatGpt)
         {
-            radix_sort<Base>(copy.begin(), copy.end());
-            return copy;
+            size_t skipped{};
+            if (parallel)
+                parallel_radix_sort<Base>(data, data + size, &skipped, parallelThreshold, Payloads<>{}, key.projection, scratch, &scratch_arena(), scatterOptions);
+            else
+                radix_sort<Base>(data, data + size, &skipped, Payloads<>{}, key.projection, scratch, &scratch_arena(), scatterOptions);
+            skippedPasses = skipped;
+            return;
+        }
+
+        if (inPlace)
+        {
+            sort_in_place(data, size);
+            return;
+        }
+
+        ScratchArena::Scope scope(scratch_arena());
+        ScratchBuffer<T> const buffer(scratch_arena(), scratch ? 0 : size);
+        if (!scratch)
+            scratch = buffer.data();
+
+        sort_with_temp(data, scratch, Payloads<>{}, Payloads<>{}, size, get_max_digits(data, size), false);
+    }
+
+    // Sort in to out, which must not overlap. scratch is as for sort.
+    // The input is copied to out or to scratch, whichever
+    // makes the last level write to out, so there is no copy back at the end.
+    void sort_to(T const* in, size_t size, T* out, T* scratch = nullptr)
+    {
+        if (chatGpt || inPlace || size < 2)
+        {
+            std::copy(in, in + size, out);
+            sort(out, size, scratch);
+            return;
+        }
+
+        skippedPasses = 0;
+
+        ScratchArena::Scope scope(scratch_arena());
+        ScratchBuffer<T> const buffer(scratch_arena(), scratch ? 0 : size);
+        if (!scratch)
+            scratch = buffer.data();
+
+        // The copy is made while finding the key statistics, before the digits
+        // are known, so where it goes is chosen by the digits of the widest key.
+        bool const result_in_temp = fewest_copies(get_digits(~typename Key::type(0)));
+        T* const first = result_in_temp ? scratch : out;
+        auto const max_digits = use_key_stats(get_key_stats(in, size, first, key.projection));
+        sort_with_temp(first, result_in_temp ? out : scratch, Payloads<>{}, Payloads<>{}, size, max_digits, result_in_temp);
+    }
+
+#if __cpp_lib_span
+    // sort and sort_to for spans.
+    void sort(std::span<T> data)
+    {
+        sort(data.data(), data.size());
+    }
+
+    void sort(std::span<T> data, std::span<T> scratch)
+    {
+        assert(scratch.size() >= data.size());
+        sort(data.data(), data.size(), scratch.data());
+    }
+
+    void sort_to(std::span<T const> in, std::span<T> out, std::span<T> scratch = {})
+    {
+        assert(out.size() >= in.size());
+        assert(scratch.empty() || scratch.size() >= in.size());
+        sort_to(in.data(), in.size(), out.data(), scratch.empty() ? nullptr : scratch.data());
+    }
+#endif
+
+    // Sort keys, and permute each values array the same way. That is,
+    // sort rows of (key, value...) by key, with each column in its own array.
+    // Only keys are read to build histograms, and values are moved
+    // in the same loops as keys.
+    //
+    // The sort is stable, so sorts by several columns can be chained,
+    // least significant column first, e.g. with row ids as the values.
+    // inPlace is ignored, because it is not stable.
+    template <typename... V>
+    void sort_by_key(T* keys, size_t size, V*... values)
+    {
+        Payloads<V...> const payloads{{values...}};
+
+        skippedPasses = 0;
+
+        if (chatGpt)
+        {
+            size_t skipped{};
+            if (parallel)
+                parallel_radix_sort<Base>(keys, keys + size, &skipped, parallelThreshold, payloads, key.projection, nullptr, &scratch_arena(), scatterOptions);
+            else
+                radix_sort<Base>(keys, keys + size, &skipped, payloads, key.projection, nullptr, &scratch_arena(), scatterOptions);
+            skippedPasses = skipped;
+            return;
+        }
+
+        if (size < 2)
+            return;
+
+        ScratchArena::Scope scope(scratch_arena());
+        ScratchBuffer<T> const buffer(scratch_arena(), size);
+        T* const temp = buffer.data();
+        typename Payloads<V...>::Scratch const values_buffer(scratch_arena(), size);
+        auto const values_temp = values_buffer.arrays();
+
+        // Ask for the result in keys, instead of copying it back from temp.
+        sort_with_temp(keys, temp, payloads, values_temp, size, get_max_digits(keys, size), false);
+    }
+
+    // Return the permutation that sorts [begin, end), instead of the sorted data.
+    // That is, element i of the sorted data is begin[result[i]].
+    // Only the keys and the indices move through temp, not whole records,
+    // and then gather can apply the permutation to any number of columns.
+    // With a projection, the keys are the projected members, e.g. the
+    // timestamps of orders, sorted by key_sorter, a RadixSorter of that type.
+    // Equal keys keep their order. Index must be able to hold end - begin - 1,
+    // else std::length_error is thrown.
+    template <typename Index, typename Iterator>
+    std::vector<Index> argsort(Iterator begin, Iterator end)
+    {
+        static_assert(std::is_integral_v<Index> && std::is_unsigned_v<Index>, "Index is an unsigned integer");
+
+        size_t const size = std::distance(begin, end);
+        if (size && static_cast<uint64_t>(size - 1) > std::numeric_limits<Index>::max())
+            throw std::length_error("argsort: too many elements for Index");
+
+        std::vector<Index> permutation(size);
+        std::iota(permutation.begin(), permutation.end(), Index(0));
+
+        if constexpr (std::is_same_v<Projection, Identity>)
+        {
+            std::vector<T> keys(begin, end);
+            sort_by_key(keys.data(), size, permutation.data());
+        }
+        else
+        {
+            std::vector<projected_t<T, Projection>> keys;
+            keys.reserve(size);
+            for (auto it = begin; it != end; ++it)
+                keys.push_back(std::invoke(key.projection, *it));
+
+            if (!key_sorter)
+                key_sorter = std::make_unique<KeySorter>();
+            key_sorter->chatGpt = chatGpt;
+            key_sorter->parallel = parallel;
+            key_sorter->parallelThreshold = parallelThreshold;
+            key_sorter->scatterOptions = scatterOptions;
+            key_sorter->insertionSortThreshold = insertionSortThreshold;
+            key_sorter->threadArena = threadArena;
+            key_sorter->arena.trimThreshold = arena.trimThreshold;
+            key_sorter->arena.hugePages = arena.hugePages;
+            key_sorter->arena.prefault = arena.prefault;
+            key_sorter->sort_by_key(keys.data(), size, permutation.data());
+            skippedPasses = key_sorter->skippedPasses.load();
+        }
+        return permutation;
+    }
+
+    // argsort with the index width picked from the size, uint32_t when it fits,
+    // else uint64_t, to halve the index traffic of the common case.
+    // f is called with the permutation, a std::vector<uint32_t> or std::vector<uint64_t>.
+    template <typename Iterator, typename F>
+    void argsort(Iterator begin, Iterator end, F f)
+    {
+        if (static_cast<uint64_t>(std::distance(begin, end)) <= UINT32_MAX)
+            f(argsort<uint32_t>(begin, end));
+        else
+            f(argsort<uint64_t>(begin, end));
+    }
+
+    // Sort data in place, with no temporary proportional to size.
+    void sort_in_place(T* data, size_t size)
+    {
+        skippedPasses = 0;
+
+        if (size < 2)
+            return;
+
+        int64_t max_digits = get_max_digits(data, size);
+        if (parallel)
+        {
+            TaskGroup group;
+            tasks = &group;
+            try
+            {
+                ThreadPool::instance().run(group, [&] { in_place_helper(data, size, max_digits, get_power(max_digits)); });
+            }
+            catch (...)
+            {
+                tasks = nullptr;
+                throw;
+            }
+            tasks = nullptr;
+        }
+        else
+        {
+            in_place_helper(data, size, max_digits, get_power(max_digits));
+        }
+    }
+
+    // The arena sorts take scratch from: arena, or the thread's, per threadArena.
+    ScratchArena& scratch_arena()
+    {
+        return threadArena ? ScratchArena::thread_default() : arena;
+    }
+
+private:
+
+    // Tasks spawned by the current parallel sort, else null.
+    TaskGroup* tasks = nullptr;
+
+    // scatterOptions, with the MSD sort's streaming threshold.
+    ScatterOptions msd_scatter_options() const
+    {
+        ScatterOptions options = scatterOptions;
+        options.streamingBytes = options.msdStreamingBytes;
+        return options;
+    }
+
+    // Digits are of key(value), which is unsigned, see RadixKey.
+    // The key is chosen per sort, e.g. by whether there are negative numbers.
+    // It holds the projection, and applies it first, see ProjectedKey.
+    using Key = ProjectedKey<T, Projection>;
+    Key key;
+
+    // Sorts argsort's projected keys. It is kept, with its arena, across calls.
+    using KeySorter = RadixSorter<projected_t<T, Projection>, Base>;
+    std::unique_ptr<KeySorter> key_sorter;
+
+    // Choose the key for data, and return the number of digits in the largest key,
+    // after subtracting the smallest.
+    int64_t get_max_digits(const T* data, size_t size)
+    {
+        return use_key_stats(get_key_stats(data, size, nullptr, key.projection));
+    }
+
+    // Use the key from get_key_stats, rebased to the smallest key,
+    // and return the number of digits in the largest key, see rebase_key.
+    int64_t use_key_stats(std::pair<Key, KeyStats<typename Key::type>> const & key_stats)
+    {
+        auto const [rebased, max] = rebase_key(key_stats.first, key_stats.second);
+        // Keep the projection, which may be a lambda, which cannot be assigned.
+        static_cast<typename Key::Key&>(key) = rebased;
+        key.offset = rebased.offset;
+        return get_digits(max);
+    }
+
+    // For power of two Base, "power" is a bit shift instead of Base raised
+    // to a power, and digits are extracted with shift and mask.
+    // Division is then absent from the hot loops.
+    static constexpr bool PowerOfTwo = is_power_of_two<Base>;
+    static constexpr unsigned BaseBits = log2_base<Base>;
+
+    // Digits are extracted from keys, which are unsigned. A power is
+    // of the same type, so it cannot overflow for 64 or 128 bit keys.
+    using power_t = typename Key::type;
+
+    // Magnitude of value, without overflow for the most negative value.
+    template <typename V>
+    static auto magnitude(V value)
+    {
+        using U = typename radix_traits<V>::unsigned_type;
+        if constexpr (radix_traits<V>::is_signed)
+            return (value < 0) ? static_cast<U>(U(0) - static_cast<U>(value)) : static_cast<U>(value);
+        else
+            return static_cast<U>(value);
+    }
+
+    template <typename V>
+    static unsigned get_digits(V value)
+    {
+        // Return log(magnitude(value), Base)
+        //
+        // -99 => 2
+        //  -1 => 1
+        //   0 => 1
+        //  99 => 2
+        // Caller inevitably has to special case negative numbers.
+        if constexpr (PowerOfTwo)
+            return get_digits_pow2<Base>(magnitude(value));
+
+        unsigned digits{1};
+
+        if constexpr (radix_traits<V>::is_signed)
+        {
+            if (value < 0)
+            {
+                if (value > -Base)
+                    return 1;
+
+                // Avoid negating the most negative value, since it will overflow.
+                // Divide first. The result cannot be the most negative value.
+                // Base cannot be 1.
+                value /= Base;
+                value *= -1;
+                ++digits;
+            }
+        }
+
+        while (value >= Base)
+        {
+            value /= Base;
+            ++digits;
+        }
+
+        return digits;
+    }
+
+    // Return the power of the most significant of n digits,
+    // i.e. Base**(n - 1), or for power of two Base, the shift (n - 1) * log2(Base).
+    static power_t get_power(unsigned n)
+    {
+        if constexpr (PowerOfTwo)
+            return (n - 1) * BaseBits;
+
+        power_t value = 1;
+        while (n > 1)
+        {
+            n -= 1;
+            value *= Base;
+        }
+        return value;
+    }
+
+    // Power of the next less significant digit.
+    static power_t next_power(power_t power)
+    {
+        if constexpr (PowerOfTwo)
+            return power - BaseBits;
+        else
+            return power / Base;
+    }
+
+    size_t get_digit(T value, power_t power)
+    {
+        if constexpr (PowerOfTwo)
+            return static_cast<size_t>((key(value) >> power) & (Base - 1));
+        else
+            return static_cast<size_t>(key(value) / power % Base);
+    }
+
+    using array = std::array<size_t, Base>;
+
+    // Count elements by digit, and compute the starting position of each bucket.
+    void histogram(
+        const T* data,
+        size_t size,
+        power_t power,
+        array& counts,
+        array& positions)
+    {
+        size_t i{};
+        size_t position{};
+
+        // count them, see radix_sort_histogram.h
+        count_digits_into<Base>(data, size, key, &power, 1, &counts);
+
+        // compute range starts
+        for (i = 0; i < Base; ++i)
+        {
+            positions[i] = position;
+            position += counts[i];
+        }
+    }
+
+    // max_digits determines recursion depth, determines number
+    // of times data and temp swap. Return true if most of the data ends
+    // in temp, absent skipped digits, i.e. where the result is cheapest.
+    static bool fewest_copies(int64_t max_digits)
+    {
+        return (max_digits & 1);
+    }
+
+    // Sort data, and values along with it, using temp and values_temp.
+    // The result goes in temp and values_temp if result_in_temp, else in data and values.
+    // max_digits is from get_max_digits, which also chose the key.
+    template <typename P>
+    void sort_with_temp(T* data, T* temp, P values, P values_temp, size_t size, int64_t max_digits, bool result_in_temp)
+    {
+        if (parallel)
+        {
+            TaskGroup group;
+            tasks = &group;
+            try
+            {
+                ThreadPool::instance().run(group, [&] { parallel_helper(data, temp, values, values_temp, size, max_digits, get_power(max_digits), result_in_temp); });
+            }
+            catch (...)
+            {
+                tasks = nullptr;
+                throw;
+            }
+            tasks = nullptr;
+        }
+        else
+        {
+            helper(data, temp, values, values_temp, size, max_digits, get_power(max_digits), result_in_temp);
+        }
+    }
+
+    // Stable sort of a small range, in place.
+    // Keys are compared, not values, to order the same as the radix sort,
+    // e.g. for floating point -0.0 and NaN.
+    template <typename P>
+    void insertion_sort(T* data, P values, size_t size)
+    {
+        for (size_t i = 1; i < size; ++i)
+        {
+            T value = data[i];
+            auto const payload = values.get(i);
+            auto const value_key = key(value);
+            size_t j = i;
+            while (j > 0 && value_key < key(data[j - 1]))
+            {
+                data[j] = data[j - 1];
+                values.move(j, values, j - 1);
+                --j;
+            }
+            data[j] = value;
+            values.set(j, payload);
+        }
+    }
+
+    // Sort data, by the digit at power and then less significant digits.
+    // The sorted result goes in temp if result_in_temp, else in data.
+    // values move along with data, using values_temp.
+    template <typename P>
+    void helper(
+        T* data,
+        T* temp,
+        P values,
+        P values_temp,
+        size_t size,
+        int64_t max_digits,
+        power_t power,
+        bool result_in_temp)
+    {
+        if (size >= 2 && size <= insertionSortThreshold)
+        {
+            // Small bucket, sort it where the result goes.
+            if (result_in_temp)
+            {
+                std::copy(data, data + size, temp);
+                values.copy(values_temp, size);
+                insertion_sort(temp, values_temp, size);
+            }
+            else
+            {
+                insertion_sort(data, values, size);
+            }
+        }
+        else if (size >= 2)
+        {
+            array positions{};
+            array counts{};
+            size_t i{};
+
+            histogram(data, size, power, counts, positions);
+
+            // If every element has the same digit, there is nothing to
+            // scatter. Move on to the next digit with data and temp as they are.
+            if (counts[get_digit(data[0], power)] == size)
+            {
+                skippedPasses += 1;
+                if (max_digits > 1)
+                    helper(data, temp, values, values_temp, size, max_digits - 1, next_power(power), result_in_temp);
+                else if (result_in_temp)
+                {
+                    std::copy(data, data + size, temp);
+                    values.copy(values_temp, size);
+                }
+                return;
+            }
+
+            {
+                auto current_position = positions;
+
+                // place them in ranges
+                scatter(data, values, size, temp, values_temp, current_position,
+                    [&](T const & value) { return get_digit(value, power); }, msd_scatter_options());
+            }
+
+            // temp is now partially sorted (more than data)
+            // swap temp and data
+            // sort ranges
+
+            if (max_digits > 1)
+            {
+                for (i = 0; i < Base; ++i)
+                {
+                    auto const offset = positions[i];
+                    // Recursive depth is limited by log of the largest magintude data.
+                    recurse(temp + offset, data + offset, values_temp + offset, values + offset,
+                        counts[i], max_digits - 1, next_power(power), !result_in_temp);
+                }
+            }
+            else if (!result_in_temp)
+            {
+                // Only happens if a digit was skipped.
+                std::copy(temp, temp + size, data);
+                values_temp.copy(values, size);
+            }
         }
         else
         {
-            // To limit copying, two temporaries repeatedly swap roles.
-            auto const size{copy.size()};
-            if (size < 2)
-                return copy;
+            // Recursion depth is limited to max_digits, but also stops when size==1.
+            // We could recurse till max_digits == 0, but that would only
+            // move elements back and forth between data and temp. Instead, do one
+            // last copy if needed and stop recursing.
+            if (result_in_temp)
+            {
+                std::copy(data, data + size, temp);
+                values.copy(values_temp, size);
+            }
+        }
+    }
+
+    // Call helper for one bucket, as a task if it is large and the sort is parallel.
+    template <typename P>
+    void recurse(
+        T* data,
+        T* temp,
+        P values,
+        P values_temp,
+        size_t size,
+        int64_t max_digits,
+        power_t power,
+        bool result_in_temp)
+    {
+        if (tasks && size >= parallelThreshold)
+        {
+            ThreadPool::instance().spawn(*tasks, [this, data, temp, values, values_temp, size, max_digits, power, result_in_temp]
+            {
+                helper(data, temp, values, values_temp, size, max_digits, power, result_in_temp);
+            });
+        }
+        else
+        {
+            helper(data, temp, values, values_temp, size, max_digits, power, result_in_temp);
+        }
+    }
+
+    // Like helper, but the data is split into chunks, and each chunk is
+    // counted and then scattered by its own thread. Each chunk gets its own
+    // histogram. The position of a chunk's elements with a given digit is after
+    // all smaller digits, and after the same digit in earlier chunks.
+    // Then the buckets are sorted by helper, as tasks.
+    template <typename P>
+    void parallel_helper(
+        T* data,
+        T* temp,
+        P values,
+        P values_temp,
+        size_t size,
+        int64_t max_digits,
+        power_t power,
+        bool result_in_temp)
+    {
+        auto& pool = ThreadPool::instance();
+        size_t const chunks = std::min(pool.concurrency() * 4, size / parallelThreshold);
+
+        if (chunks < 2)
+        {
+            recurse(data, temp, values, values_temp, size, max_digits, power, result_in_temp);
+            return;
+        }
+
+        std::vector<array> chunk_counts(chunks);
+        auto chunk_begin = [=](size_t chunk) { return size * chunk / chunks; };
+
+        pool.parallel_for(chunks, [&](size_t chunk)
+        {
+            size_t const first = chunk_begin(chunk);
+            count_digits_into<Base>(data + first, chunk_begin(chunk + 1) - first, key, &power, 1, &chunk_counts[chunk]);
+        });
 
-            std::vector<T> temp(size);
+        array counts{};
+        array positions{};
+        size_t i{};
+        size_t position{};
 
-            T max = std::accumulate(copy.begin(), copy.end(), copy[0], [](T a, T b) { return std::max(a,b);});
+        for (auto const& chunk : chunk_counts)
+            for (i = 0; i < Base; ++i)
+                counts[i] += chunk[i];
+
+        if (counts[get_digit(data[0], power)] == size)
+        {
+            skippedPasses += 1;
+            if (max_digits > 1)
+                parallel_helper(data, temp, values, values_temp, size, max_digits - 1, next_power(power), result_in_temp);
+            else if (result_in_temp)
+            {
+                std::copy(data, data + size, temp);
+                values.copy(values_temp, size);
+            }
+            return;
+        }
+
+        // Turn the chunk counts into the chunk's starting positions.
+        for (i = 0; i < Base; ++i)
+        {
+            positions[i] = position;
+            for (auto& chunk : chunk_counts)
+            {
+                auto const count = chunk[i];
+                chunk[i] = position;
+                position += count;
+            }
+        }
+
+        pool.parallel_for(chunks, [&](size_t chunk)
+        {
+            size_t const first = chunk_begin(chunk);
+            scatter(data + first, values + first, chunk_begin(chunk + 1) - first, temp, values_temp, chunk_counts[chunk],
+                [&](T const & value) { return get_digit(value, power); }, msd_scatter_options());
+        });
+
+        if (max_digits > 1)
+        {
+            for (i = 0; i < Base; ++i)
+            {
+                auto const offset = positions[i];
+                recurse(temp + offset, data + offset, values_temp + offset, values + offset,
+                    counts[i], max_digits - 1, next_power(power), !result_in_temp);
+            }
+        }
+        else if (!result_in_temp)
+        {
+            // Only happens if a digit was skipped.
+            std::copy(temp, temp + size, data);
+            values_temp.copy(values, size);
+        }
+    }
+
+    // Like helper, but without temp. Each bucket has a "next" position,
+    // starting at its start. Walk each bucket, and for each element
+    // not already in its bucket, swap it to the next position of the bucket
+    // it belongs in. That brings another element into hand, and so on around
+    // the cycle, until the element in hand belongs where we started.
+    // Every element is moved at most once to its final bucket.
+    void in_place_helper(
+        T* data,
+        size_t size,
+        int64_t max_digits,
+        power_t power)
+    {
+        if (size < 2)
+            return;
+
+        if (size <= insertionSortThreshold)
+        {
+            insertion_sort(data, Payloads<>{}, size);
+            return;
+        }
+
+        array positions{};
+        array counts{};
+        size_t i{};
+
+        histogram(data, size, power, counts, positions);
+
+        // If every element has the same digit, nothing moves.
+        if (counts[get_digit(data[0], power)] == size)
+            skippedPasses += 1;
+        else
+        {
+            auto next = positions;
+
+            for (i = 0; i < Base; ++i)
+            {
+                auto const end = positions[i] + counts[i];
+                while (next[i] < end)
+                {
+                    T value = data[next[i]];
+                    auto digit = get_digit(value, power);
+                    while (digit != i)
+                    {
+                        std::swap(value, data[next[digit]++]);
+                        digit = get_digit(value, power);
+                    }
+                    data[next[i]++] = value;
+                }
+            }
+        }
+
+        if (max_digits > 1)
+        {
+            for (i = 0; i < Base; ++i)
+            {
+                T* const bucket = data + positions[i];
+                size_t const count = counts[i];
+                if (tasks && count >= parallelThreshold)
+                {
+                    ThreadPool::instance().spawn(*tasks, [this, bucket, count, max_digits, power]
+                    {
+                        in_place_helper(bucket, count, max_digits - 1, next_power(power));
+                    });
+                }
+                else
+                {
+                    in_place_helper(bucket, count, max_digits - 1, next_power(power));
+                }
+            }
+        }
+    }
+
+    friend int main(int argc, char** argv);;
+};
+
+#include "radix_sort_external.cpp"
+#include "radix_sort_file.cpp"
+
+template <typename T, int64_t Base>
+class TestRadixSorter : public RadixSorter<T, Base>
+{
+public:
+    // Also sort without the insertion sort cutoff, so the
+    // radix code is exercised on small inputs, and compare.
+    bool alsoWithoutInsertionSort = true;
+
+    TestRadixSorter()
+    {
+        // Small, so the parallel code is exercised on small inputs.
+        this->parallelThreshold = 64;
+    }
+
+    template <typename Iterator>
+    std::vector<T> operator()(bool reverse, Iterator begin, Iterator end)
+    {
+        if (reverse)
+            std::reverse(begin, end);
+
+        auto const sorted = RadixSorter<T, Base>::operator()(begin, end);
+        assert(sorted.size() == (end - begin));
+        if (sorted.size() <= 10)
+            verbose(sorted.begin(), sorted.end());
+        check(sorted.begin(), sorted.end());
+
+        auto const threshold = this->insertionSortThreshold;
+        if (alsoWithoutInsertionSort && threshold)
+        {
+            this->insertionSortThreshold = 0;
+            auto const sorted2 = RadixSorter<T, Base>::operator()(begin, end);
+            this->insertionSortThreshold = threshold;
+            assert(sorted == sorted2);
+        }
+        return sorted;
+    }
+
+    template <typename Iterator>
+    void verbose(Iterator begin, Iterator end, bool success = true)
+    {
+        auto ToChar = [](int a)
+        {
+            return (a > 0 && a < 128 && isprint(a)) ? a : '?';
+        };
+
+        if (!success) printf("%s\n", success ? "success" : "failed");
+        for (auto it{begin}; it != end; ++it)
+            printf("%d %c ", (int)*it, ToChar(*it));
+        assert(success);
+    }
+
+    template <typename Iterator>
+    void check(Iterator begin, Iterator end)
+    {
+        auto previous{begin};
+        for (auto it{begin}; it != end; ++it)
+        {
+            if (it != begin)
+            {
+                if (!(*previous++ <= *it))
+                {
+                    verbose(begin, end, false);
+                    return;
+                }
+            }
+        }
+    }
+};
+
+// Milliseconds since some arbitrary point, for Benchmark.
+static int64_t milliseconds()
+{
+    using namespace std::chrono;
+    return duration_cast<std::chrono::milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Page faults of the process so far, for Benchmark. 0 where unknown.
+static int64_t page_faults()
+{
+#if _WIN32
+    return 0;
+#else
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+#endif
+}
+
+// Time MSD sort for a few insertion sort thresholds, to choose
+// RadixSorter::default_insertion_sort_threshold.
+template <int64_t Base>
+void BenchmarkInsertionSortThreshold(std::vector<int> const & orig)
+{
+    size_t const size = orig.size();
+    std::vector<int> data;
+    TestRadixSorter<int, Base> test_sort;
+    test_sort.alsoWithoutInsertionSort = false;
+    size_t best_threshold{};
+    int64_t best_time{-1};
+
+    printf("base:%d insertion sort threshold:", (int)Base);
+    for (size_t threshold : {0, 8, 16, 24, 32, 48, 64, 96, 128})
+    {
+        data = orig;
+        test_sort.insertionSortThreshold = threshold;
+        int64_t const start = milliseconds();
+        test_sort(false, &data[0], &data[size]);
+        int64_t const time = milliseconds() - start;
+        printf(" %d:%dms", (int)threshold, (int)time);
+        if (best_time < 0 || time < best_time)
+        {
+            best_time = time;
+            best_threshold = threshold;
+        }
+    }
+    printf(" best:%d default:%d\n", (int)best_threshold, (int)test_sort.default_insertion_sort_threshold());
+}
+
+// Time both engines on random values of type T, e.g. to compare
+// floating point keys with integer keys of the same width.
+template <typename T, int64_t Base>
+void BenchmarkType(const char* name, size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<T> orig(size);
+    std::vector<T> data;
+
+    for (auto& value : orig)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            value = static_cast<T>(std::uniform_real_distribution<double>(-1e9, 1e9)(engine));
+        else
+            value = static_cast<T>(engine());
+    }
+
+    TestRadixSorter<T, Base> test_sort;
+    test_sort.alsoWithoutInsertionSort = false;
+
+    data = orig;
+    int64_t const start = milliseconds();
+    test_sort(false, data.begin(), data.end());
+    int64_t const end = milliseconds();
+
+    data = orig;
+    test_sort.chatGpt = true;
+    int64_t const start_ChatGpt = milliseconds();
+    test_sort(false, data.begin(), data.end());
+    int64_t const end_ChatGpt = milliseconds();
+
+    printf("%s base:%d noChatGpt:%dms chatGpt:%dms\n", name, (int)Base, (int)(end - start), (int)(end_ChatGpt - start_ChatGpt));
+}
+
+// Random short strings, like log fields, with a common prefix,
+// sorted by StringRadixSorter and by std::sort.
+void BenchmarkStrings(size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<std::string> orig(size);
+
+    for (auto& s : orig)
+    {
+        s = "host";
+        size_t const length = engine() % 16;
+        for (size_t i = 0; i < length; ++i)
+            s += static_cast<char>('a' + engine() % 26);
+    }
+
+    auto data = orig;
+    int64_t const start = milliseconds();
+    StringRadixSorter sort;
+    sort(data.begin(), data.end());
+    int64_t const end = milliseconds();
+
+    auto data2 = orig;
+    int64_t const start_std = milliseconds();
+    std::sort(data2.begin(), data2.end());
+    int64_t const end_std = milliseconds();
+    assert(data == data2);
+
+    printf("strings radix:%dms std::sort:%dms skipped:%zu\n", (int)(end - start), (int)(end_std - start_std), sort.skippedPasses);
+}
+
+// Many sorts of medium arrays, reusing the arena's memory,
+// and with trimThreshold 0, which frees it after every sort.
+void BenchmarkArena(size_t size)
+{
+    size_t const medium = 1 << 18;
+    std::mt19937 engine(13579);
+    std::vector<int> orig(medium);
+    for (auto& value : orig)
+        value = static_cast<int>(engine());
+    std::vector<int> data(medium);
+
+    RadixSorter<int, 256> sort;
+    size_t const count = std::max<size_t>(size / medium, 1);
+    int64_t times[2]{};
+
+    for (int reuse = 1; reuse >= 0; --reuse)
+    {
+        sort.arena.trimThreshold = reuse ? ScratchArena().trimThreshold : 0;
+        std::copy(orig.begin(), orig.end(), data.begin());
+        sort.sort(data.data(), medium);
+        int64_t const start = milliseconds();
+        for (size_t i = 0; i < count; ++i)
+        {
+            std::copy(orig.begin(), orig.end(), data.begin());
+            sort.sort(data.data(), medium);
+        }
+        times[reuse] = milliseconds() - start;
+    }
+
+    printf("%zu sorts of %zu ints arena:%dms noArena:%dms\n", count, medium, (int)times[1], (int)times[0]);
+}
+
+// Page faults and time of sorting int64 with a new arena, with small pages,
+// huge pages, and huge pages pre-faulted in parallel. Then again, reusing the arena.
+void BenchmarkScratchPages(size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<int64_t> orig(size);
+    for (auto& value : orig)
+        value = static_cast<int64_t>(engine());
+    std::vector<int64_t> data;
+
+    char const * const names[] = {"smallPages", "hugePages", "hugePagesPrefault"};
+
+    for (int config = 0; config < 3; ++config)
+    {
+        RadixSorter<int64_t, 256> sort;
+        sort.arena.hugePages = (config >= 1);
+        sort.arena.prefault = (config == 2);
+
+        for (int reuse = 0; reuse <= 1; ++reuse)
+        {
+            data = orig;
+            int64_t const faults = page_faults();
+            int64_t const start = milliseconds();
+            sort.sort(data.data(), size);
+            int64_t const end = milliseconds();
+            printf("%s%s:%dms faults:%d\n", names[config], reuse ? " reuse" : "",
+                (int)(end - start), (int)(page_faults() - faults));
+        }
+    }
+}
+
+// Plain scatter, write combined scatter, write combined with streaming stores,
+// and the defaults, for both engines, on random uint64. Run on data larger
+// than the last level cache, this checks streamingBytes and msdStreamingBytes.
+void BenchmarkScatter(size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<uint64_t> orig(size);
+    for (auto& value : orig)
+        value = engine();
+    std::vector<uint64_t> data;
+
+    char const * const names[] = {"plain", "writeCombining", "writeCombiningStreaming", "default"};
+
+    for (int chatGpt = 0; chatGpt <= 1; ++chatGpt)
+    {
+        printf("scatter size:%zu %s", size, chatGpt ? "chatGpt" : "noChatGpt");
+        for (int config = 0; config < 4; ++config)
+        {
+            RadixSorter<uint64_t, 256> sort;
+            sort.chatGpt = chatGpt;
+            if (config < 3)
+            {
+                sort.scatterOptions.writeCombiningThreshold = config ? ScatterOptions().writeCombiningThreshold : SIZE_MAX;
+                sort.scatterOptions.streamingBytes = (config == 2) ? 0 : SIZE_MAX;
+                sort.scatterOptions.msdStreamingBytes = sort.scatterOptions.streamingBytes;
+            }
+
+            // Once to fault in the arena, then time it.
+            data = orig;
+            sort.sort(data.data(), size);
+            data = orig;
+            int64_t const start = milliseconds();
+            sort.sort(data.data(), size);
+            printf(" %s:%dms", names[config], (int)(milliseconds() - start));
+        }
+        printf("\n");
+    }
+}
+
+// Histogram throughput, plain loop and each level of count_digits_into, up to simd_level(),
+// for one digit of int32 and uint64, on sorted and low cardinality data,
+// where neighbors mostly have the same digit, and random data.
+template <typename T>
+void BenchmarkHistogramType(char const * name, size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<T> data(size);
+    auto const key = ProjectedKey<T>(RadixKey<T>(true));
+    using K = typename decltype(key)::type;
+    K const power = sizeof(K) * CHAR_BIT - 8;
+    size_t const repeat = 20;
+
+    for (int kind = 0; kind < 3; ++kind)
+    {
+        static char const * const kinds[] = {"sorted", "lowCardinality", "random"};
+        for (size_t i = 0; i < size; ++i)
+            data[i] = (kind == 0) ? static_cast<T>(i << (sizeof(T) * CHAR_BIT - 24)) :
+                (kind == 1) ? static_cast<T>(engine() % 4) << (sizeof(T) * CHAR_BIT - 8) : static_cast<T>(engine());
+
+        std::array<size_t, 256> counts{};
+        int64_t start = milliseconds();
+        for (size_t r = 0; r < repeat; ++r)
+            for (size_t i = 0; i < size; ++i)
+                counts[(key(data[i]) >> power) & 255] += 1;
+        printf("histogram %s %s plain:%dms", name, kinds[kind], (int)(milliseconds() - start));
+
+        for (int level = 0; level <= (int)simd_level(); ++level)
+        {
+            std::array<size_t, 256> level_counts{};
+            start = milliseconds();
+            for (size_t r = 0; r < repeat; ++r)
+                count_digits_into<256>(data.data(), size, key, &power, 1, &level_counts, SimdLevel(level));
+            printf(" %s:%dms", level ? simd_level_name(SimdLevel(level)) : "tables", (int)(milliseconds() - start));
+            assert(level_counts == counts);
+        }
+        printf("\n");
+    }
+}
+
+void BenchmarkHistograms(size_t size)
+{
+    BenchmarkHistogramType<int32_t>("int32", size);
+    BenchmarkHistogramType<uint64_t>("uint64", size);
+}
+
+// The pass before sorting: copy, then min and max, as operator() did,
+// against the fused copy and statistics, at each level.
+template <typename T>
+void BenchmarkPreambleType(char const * name, size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<T> data(size);
+    for (auto& value : data)
+        value = static_cast<T>(engine());
+    std::vector<T> copy(size);
+    size_t const repeat = 20;
+    typename RadixKey<T>::type sink{};
+
+    int64_t start = milliseconds();
+    for (size_t r = 0; r < repeat; ++r)
+    {
+        std::copy(data.begin(), data.end(), copy.begin());
+        auto const [min, max] = std::minmax_element(copy.begin(), copy.end());
+        sink += RadixKey<T>(*min < 0)(*max);
+    }
+    printf("preamble %s copyMinMax:%dms", name, (int)(milliseconds() - start));
+
+    for (int level = 0; level <= (int)simd_level(); ++level)
+    {
+        start = milliseconds();
+        for (size_t r = 0; r < repeat; ++r)
+            sink += get_key_stats(data.data(), size, copy.data(), Identity{}, SimdLevel(level)).second.max;
+        printf(" %s:%dms", simd_level_name(SimdLevel(level)), (int)(milliseconds() - start));
+    }
+    printf(" (%d)\n", (int)(sink & 1));
+}
+
+void BenchmarkPreamble(size_t size)
+{
+    BenchmarkPreambleType<int32_t>("int32", size);
+    BenchmarkPreambleType<int64_t>("int64", size);
+}
+
+// Timestamps within a minute, in milliseconds since 1970, of which only the
+// low 2 of 8 bytes vary, and ids in a narrow range across a power of two,
+// where the top differing bit is high, but the spread is small.
+void BenchmarkRangeCompression(size_t size)
+{
+    std::mt19937_64 engine(size);
+    std::vector<int64_t> timestamps(size);
+    std::vector<uint64_t> ids(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        timestamps[i] = 1700000000000 + static_cast<int64_t>(engine() % 60000);
+        ids[i] = (uint64_t(1) << 40) - 30000 + engine() % 60000;
+    }
+
+    for (int chatGpt = 0; chatGpt <= 1; ++chatGpt)
+    {
+        RadixSorter<int64_t, 256> sort_timestamps;
+        RadixSorter<uint64_t, 256> sort_ids;
+        sort_timestamps.chatGpt = chatGpt;
+        sort_ids.chatGpt = chatGpt;
+        sort_timestamps(timestamps.begin(), timestamps.end());
+        sort_ids(ids.begin(), ids.end());
+
+        int64_t const start = milliseconds();
+        sort_timestamps(timestamps.begin(), timestamps.end());
+        int64_t const middle = milliseconds();
+        sort_ids(ids.begin(), ids.end());
+        printf("range %s timestamps:%dms skipped:%zu ids:%dms skipped:%zu\n", chatGpt ? "chatGpt" : "noChatGpt",
+            (int)(middle - start), (size_t)sort_timestamps.skippedPasses, (int)(milliseconds() - middle), (size_t)sort_ids.skippedPasses);
+    }
+}
+
+void Benchmark(size_t size)
+{
+    printf("simd:%s cpu:%s\n", simd_level_name(simd_level()), simd_level_name(cpu_simd_level()));
+
+    std::vector<int> orig(size, 0);
+    std::vector<int> data(size, 0);
+
+    for (size_t i = 0; i < size; ++i)
+        orig[i] = (0x7fffffff & rand());
+
+    TestRadixSorter<int, 16> test_sort;
+    test_sort.alsoWithoutInsertionSort = false;
+
+    data = orig;
+    int64_t faults_ChatGpt = page_faults();
+    int64_t start_ChatGpt = milliseconds();
+    test_sort.chatGpt = true;
+    test_sort(false, &data[0], &data[size]);
+    int64_t end_ChatGpt = milliseconds();
+    faults_ChatGpt = page_faults() - faults_ChatGpt;
+    size_t skipped_ChatGpt = test_sort.skippedPasses;
+
+    data = orig;
+    int64_t faults_NoChatGpt = page_faults();
+    int64_t start_NoChatGpt = milliseconds();
+    test_sort.chatGpt = false;
+    test_sort(false, &data[0], &data[size]);
+    int64_t end_NoChatGpt = milliseconds();
+    faults_NoChatGpt = page_faults() - faults_NoChatGpt;
+    size_t skipped_NoChatGpt = test_sort.skippedPasses;
+
+    data = orig;
+    int64_t start_InPlace = milliseconds();
+    test_sort.inPlace = true;
+    test_sort(false, &data[0], &data[size]);
+    int64_t end_InPlace = milliseconds();
+    size_t skipped_InPlace = test_sort.skippedPasses;
+
+    data = orig;
+    test_sort.inPlace = false;
+    test_sort.parallel = true;
+    test_sort.parallelThreshold = RadixSorter<int, 16>().parallelThreshold;
+    int64_t start_Parallel = milliseconds();
+    test_sort(false, &data[0], &data[size]);
+    int64_t end_Parallel = milliseconds();
+
+    data = orig;
+    test_sort.chatGpt = true;
+    int64_t start_ChatGptParallel = milliseconds();
+    test_sort(false, &data[0], &data[size]);
+    int64_t end_ChatGptParallel = milliseconds();
+    test_sort.chatGpt = false;
+    test_sort.parallel = false;
+
+    printf("noChatGpt:%dms skipped:%zu faults:%d\n", (int)(end_NoChatGpt - start_NoChatGpt), skipped_NoChatGpt, (int)faults_NoChatGpt);
+    printf("inPlace:%dms skipped:%zu\n",   (int)(end_InPlace - start_InPlace), skipped_InPlace);
+    printf("parallel:%dms threads:%zu\n",  (int)(end_Parallel - start_Parallel), ThreadPool::instance().concurrency());
+    printf("chatGpt:%dms skipped:%zu faults:%d\n", (int)(end_ChatGpt - start_ChatGpt), skipped_ChatGpt, (int)faults_ChatGpt);
+    printf("chatGptParallel:%dms\n",      (int)(end_ChatGptParallel - start_ChatGptParallel));
+
+    BenchmarkType<int32_t, 256>("int32", size);
+    BenchmarkType<float, 256>("float", size);
+    BenchmarkType<int64_t, 256>("int64", size);
+    BenchmarkType<double, 256>("double", size);
+
+    BenchmarkInsertionSortThreshold<4>(orig);
+    BenchmarkInsertionSortThreshold<16>(orig);
+    BenchmarkInsertionSortThreshold<256>(orig);
+
+    BenchmarkStrings(size);
+    BenchmarkArena(size);
+    BenchmarkScratchPages(size);
+    BenchmarkScatter(size);
+    // Twice the last level cache, where streaming starts.
+    BenchmarkScatter(std::max(size, 2 * last_level_cache_size() / sizeof(uint64_t)));
+    BenchmarkHistograms(size);
+    BenchmarkPreamble(size);
+    BenchmarkRangeCompression(size);
+}
+
+// Sort the extremes of type T, which overflowed powers of Base before.
+template <typename T, int64_t Base>
+void TestExtremeIntegers(bool reverse, bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    T const max = radix_traits<T>::is_signed ? T(~T(0) ^ (T(1) << (sizeof(T) * CHAR_BIT - 1))) : T(~T(0));
+    T const min = radix_traits<T>::is_signed ? T(~max) : T(0);
+    std::vector<T> data{max, min, 0, T(-1), 1, T(max - 1), T(min + 1), T(max / 3), T(min / 3), max};
+    TestRadixSorter<T, Base> test_sort;
+    test_sort.chatGpt = chatGpt;
+    test_sort.inPlace = inPlace;
+    test_sort.parallel = parallel;
+    auto const sorted = test_sort(reverse, data.begin(), data.end());
+    assert(sorted.front() == min);
+    assert(sorted.back() == max);
+}
+
+// Sort random integers of type T, in many bases, for sizes from 2 to 998, by step.
+template <typename T>
+void TestRandomIntegers(bool reverse, bool chatGpt, bool inPlace, bool parallel, int step)
+{
+    // StackOverflow for random number generation.
+    // Full range values, including for 128 bits, from 64 random bits at a time.
+    std::random_device dev;
+    std::mt19937_64 engine(dev());
+    auto random = [&]
+    {
+        using U = typename radix_traits<T>::unsigned_type;
+        U value = static_cast<U>(engine());
+        if constexpr (sizeof(U) > sizeof(uint64_t))
+            value = (value << 64) | engine();
+        return static_cast<T>(value);
+    };
+
+    // random data
+    printf("\nline:%d\n", __LINE__);
+    for (int size = 2; size < 999; size += step)
+    {
+        T data[999]{};
+        for (int index = 0; index < size; ++index)
+        {
+            data[index] = random();
+        }
+
+        {
+            TestRadixSorter<T, 2> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 3> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 4> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 5> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 10> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 16> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 20> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 100> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+
+        {
+            TestRadixSorter<T, 256> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort(reverse, data, &data[size]);
+        }
+    }
+}
+
+// Sort keys with many duplicates, with row ids and another column as values.
+// Check the keys are sorted, the values moved with them, and equal keys
+// kept their order. Then sort by a second column, chained, least significant first.
+template <typename T, int64_t Base>
+void TestSortByKey(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937 engine(5678);
+
+    for (size_t size : {0, 1, 2, 3, 50, 999, 5000})
+    {
+        std::vector<T> keys(size);
+        std::vector<uint32_t> ids(size);
+        std::vector<double> column(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            keys[i] = static_cast<T>(static_cast<int>(engine() % 100) - 50);
+            ids[i] = static_cast<uint32_t>(i);
+            column[i] = static_cast<double>(keys[i]) * 2 + 0.5;
+        }
+        auto const original = keys;
+
+        RadixSorter<T, Base> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 64;
+        sort.sort_by_key(keys.data(), size, ids.data(), column.data());
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            assert(keys[i] == original[ids[i]]);
+            assert(column[i] == static_cast<double>(keys[i]) * 2 + 0.5);
+            if (i)
+            {
+                assert(keys[i - 1] <= keys[i]);
+                assert(keys[i - 1] < keys[i] || ids[i - 1] < ids[i]);
+            }
+        }
+
+        // Two columns: sort rows by (a, b), by sorting by b, then stably by a.
+        std::vector<T> a(size);
+        std::vector<T> b(size);
+        std::vector<uint32_t> rows(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            a[i] = static_cast<T>(engine() % 4);
+            b[i] = static_cast<T>(static_cast<int>(engine() % 7) - 3);
+            rows[i] = static_cast<uint32_t>(i);
+        }
+        auto const a0 = a;
+        auto const b0 = b;
+        sort.sort_by_key(b.data(), size, rows.data(), a.data());
+        sort.sort_by_key(a.data(), size, rows.data(), b.data());
+        for (size_t i = 0; i < size; ++i)
+        {
+            assert(a[i] == a0[rows[i]] && b[i] == b0[rows[i]]);
+            if (i)
+                assert(a[i - 1] < a[i] || (a[i - 1] == a[i] && b[i - 1] <= b[i]));
+        }
+    }
+}
+
+// argsort, then gather records and another column by the permutation,
+// and check against sorting the keys.
+template <typename T, int64_t Base>
+void TestArgsort(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937 engine(4321);
+
+    struct Record
+    {
+        T key;
+        char payload[60];
+    };
+
+    for (size_t size : {0, 1, 2, 50, 3000})
+    {
+        std::vector<T> keys(size);
+        std::vector<Record> records(size);
+        std::vector<int> column(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            keys[i] = static_cast<T>(static_cast<int>(engine() % 1000) - 500);
+            records[i].key = keys[i];
+            column[i] = static_cast<int>(i);
+        }
+
+        RadixSorter<T, Base> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 64;
+        auto const sorted = sort(keys.begin(), keys.end());
+
+        sort.argsort(keys.begin(), keys.end(), [&](auto const & permutation)
+        {
+            assert(sizeof(permutation[0]) == sizeof(uint32_t));
+            assert(permutation.size() == size);
+
+            std::vector<Record> sorted_records(size);
+            std::vector<int> sorted_column(size);
+            gather<16>(permutation.data(), size,
+                Payloads<Record, int>{{records.data(), column.data()}},
+                Payloads<Record, int>{{sorted_records.data(), sorted_column.data()}});
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                assert(sorted_records[i].key == sorted[i]);
+                assert(sorted_column[i] == static_cast<int>(permutation[i]));
+                if (i && sorted[i - 1] == sorted[i])
+                    assert(permutation[i - 1] < permutation[i]);
+            }
+        });
+
+        auto const permutation64 = sort.template argsort<uint64_t>(keys.begin(), keys.end());
+        for (size_t i = 0; i < size; ++i)
+            assert(keys[permutation64[i]] == sorted[i]);
+
+        // Indices up to 255 fit uint8_t, and more elements than that throw.
+        bool thrown = false;
+        try
+        {
+            auto const permutation8 = sort.template argsort<uint8_t>(keys.begin(), keys.end());
+            assert(size <= 256);
+            for (size_t i = 0; i < size; ++i)
+                assert(keys[permutation8[i]] == sorted[i]);
+        }
+        catch (std::length_error const &)
+        {
+            thrown = true;
+        }
+        assert(thrown == (size > 256));
+
+        // argsort of whole records by their key member. Only the member is
+        // extracted and sorted, with the indices, so the permutation is the
+        // same as argsort of the keys. Twice, the second reusing key_sorter.
+        RadixSorter<Record, Base, decltype(&Record::key)> record_sort(&Record::key);
+        record_sort.chatGpt = chatGpt;
+        record_sort.inPlace = inPlace;
+        record_sort.parallel = parallel;
+        record_sort.parallelThreshold = 64;
+        for (int repeat = 0; repeat < 2; ++repeat)
+        {
+            auto const by_member = record_sort.template argsort<uint32_t>(records.begin(), records.end());
+            assert(by_member.size() == size);
+            for (size_t i = 0; i < size; ++i)
+                assert(by_member[i] == permutation64[i]);
+        }
+    }
+}
+
+// Exceptions from tasks are rethrown by wait, after the rest of the group
+// is done, and a waiting caller sleeps instead of spinning, but still helps.
+void TestThreadPool()
+{
+    printf("\nline:%d\n", __LINE__);
+
+    for (unsigned threads : {1, 3})
+    {
+        ThreadPool pool(threads);
+
+        // Tasks, and tasks they spawn, all run, and the first exception is rethrown.
+        {
+            TaskGroup group;
+            std::atomic<int> ran{0};
+            for (int i = 0; i < 100; ++i)
+            {
+                pool.spawn(group, [&, i]
+                {
+                    pool.spawn(group, [&] { ran += 1; });
+                    ran += 1;
+                    if (i % 10 == 3)
+                        throw std::runtime_error("task");
+                });
+            }
+            bool thrown = false;
+            try
+            {
+                pool.wait(group);
+            }
+            catch (std::runtime_error const &)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(ran == 200);
+            assert(!group.pending);
+
+            // The exception is cleared, so the group can be reused.
+            pool.spawn(group, [&] { ran += 1; });
+            pool.wait(group);
+            assert(ran == 201);
+        }
+
+        // parallel_for waits for the rest even if f(0), on this thread, throws.
+        {
+            std::atomic<int> ran{0};
+            bool thrown = false;
+            try
+            {
+                pool.parallel_for(50, [&](size_t i)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    ran += 1;
+                    if (i == 0)
+                        throw std::logic_error("first");
+                });
+            }
+            catch (std::logic_error const &)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(ran == 50);
+        }
+
+        // A long task with nothing else queued: the caller sleeps until it is done.
+        {
+            TaskGroup group;
+            std::atomic<bool> done{false};
+            pool.spawn(group, [&]
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                done = true;
+            });
+            pool.wait(group);
+            assert(done);
+        }
+    }
+
+    // A projection that throws in a parallel sort, then the sorter works again.
+    std::atomic<int> calls{0};
+    auto key = [&](int64_t const & value)
+    {
+        if (++calls == 20000)
+            throw std::runtime_error("projection");
+        return value;
+    };
+    std::mt19937_64 engine(97531);
+    std::vector<int64_t> data(10000);
+    for (auto& value : data)
+        value = static_cast<int64_t>(engine());
+    for (bool chatGpt : {false, true})
+    {
+        RadixSorter<int64_t, 256, decltype(key)> sort(key);
+        sort.parallel = true;
+        sort.chatGpt = chatGpt;
+        sort.parallelThreshold = 64;
+        calls = 0;
+        bool thrown = false;
+        try
+        {
+            sort(data.begin(), data.end());
+        }
+        catch (std::runtime_error const &)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+        calls = -(1 << 30);
+        auto const sorted = sort(data.begin(), data.end());
+        assert(std::is_sorted(sorted.begin(), sorted.end()));
+    }
+}
+
+// Sort structs by a member, with a member pointer and with a lambda,
+// and check against std::stable_sort by the same member.
+void TestProjection(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(2468);
+
+    struct Order
+    {
+        int64_t timestamp;
+        float price;
+        uint32_t id;
+    };
+
+    for (size_t size : {0, 1, 2, 10, 999, 4000})
+    {
+        std::vector<Order> orders(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            orders[i].timestamp = static_cast<int64_t>(engine() % 2000) - 1000;
+            orders[i].price = static_cast<float>(static_cast<int>(engine() % 200) - 100) / 4;
+            orders[i].id = static_cast<uint32_t>(i);
+        }
 
-            if (handleNegativeNumbers)
+        {
+            RadixSorter<Order, 256, decltype(&Order::timestamp)> sort(&Order::timestamp);
+            sort.chatGpt = chatGpt;
+            sort.inPlace = inPlace;
+            sort.parallel = parallel;
+            sort.parallelThreshold = 64;
+            auto const sorted = sort(orders.begin(), orders.end());
+
+            auto expected = orders;
+            std::stable_sort(expected.begin(), expected.end(), [](Order const & a, Order const & b) { return a.timestamp < b.timestamp; });
+            for (size_t i = 0; i < size; ++i)
             {
-                // Negative numbers require some work.
-                // The model is roughly to double base.
-                // Positive numbers get a biased by base mod.
-                // There might be a better way, like if the numbers are -99..999
-                // and max digits is 2 for negative and 3 for positive.
-                T min = std::accumulate(copy.begin(), copy.end(), copy[0], [](T a, T b) { return std::min(a,b);});
-                int64_t max_digits = std::max(get_digits(min), get_digits(max));
-                helper(&copy[0], &temp[0], size, max_digits, get_power(max_digits));
-
-                // max_digits determines recursion depth, determines number
-                // of times data and temp have swapped.
-                return (max_digits & 1) ? copy : temp;
+                assert(sorted[i].timestamp == expected[i].timestamp);
+                assert(inPlace || sorted[i].id == expected[i].id);
             }
-            int64_t max_digits = get_digits(max);
-            helper(&copy[0], &temp[0], size, max_digits, get_power(max_digits));
+        }
 
-            // max_digits determines recursion depth, determines number
-            // of times data and temp have swapped.
-            return (max_digits & 1) ? copy : temp;
+        {
+            auto price = [](Order const & order) { return order.price; };
+            RadixSorter<Order, 16, decltype(price)> sort(price);
+            sort.chatGpt = chatGpt;
+            sort.inPlace = inPlace;
+            sort.parallel = parallel;
+            sort.parallelThreshold = 64;
+            auto const sorted = sort(orders.begin(), orders.end());
+
+            auto expected = orders;
+            std::stable_sort(expected.begin(), expected.end(), [](Order const & a, Order const & b) { return a.price < b.price; });
+            for (size_t i = 0; i < size; ++i)
+            {
+                assert(sorted[i].price == expected[i].price);
+                assert(inPlace || sorted[i].id == expected[i].id);
+            }
         }
     }
+}
 
-private:
+// Payload columns and records that are not trivially copyable, here with
+// std::string, get constructed scratch instead of the arena's raw memory.
+void TestNonTrivialScratch(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937 engine(1357);
 
-    static unsigned get_digits(T value)
+    struct Event
     {
-        // Return log(magnitude(value), Base)
-        //
-        // -99 => 2
-        //  -1 => 1
-        //   0 => 1
-        //  99 => 2
-        // Caller inevitably has to special case negative numbers.
-        unsigned digits{1};
+        int64_t ts;
+        std::string name;
+    };
 
-        if (value < 0)
+    for (size_t size : {0, 1, 2, 50, 3000})
+    {
+        std::vector<int32_t> keys(size);
+        std::vector<std::string> names(size);
+        std::vector<Event> events(size);
+        for (size_t i = 0; i < size; ++i)
         {
-            if (value > -Base)
-                return 1;
+            keys[i] = static_cast<int32_t>(engine() % 500) - 250;
+            // Long enough to not fit in the small string buffer.
+            names[i] = "name of row " + std::to_string(i) + " with key " + std::to_string(keys[i]);
+            events[i].ts = static_cast<int64_t>(engine() % 100000) - 50000;
+            events[i].name = "event " + std::to_string(i) + " at " + std::to_string(events[i].ts);
+        }
 
-            // Avoid negating the most negative value, since it will overflow.
-            // Divide first. The result cannot be the most negative value.
-            // Base cannot be 1.
-            value /= Base;
-            value *= -1;
-            ++digits;
+        {
+            RadixSorter<int32_t, 256> sort;
+            sort.chatGpt = chatGpt;
+            sort.inPlace = inPlace;
+            sort.parallel = parallel;
+            sort.parallelThreshold = 64;
+            sort.sort_by_key(keys.data(), size, names.data());
+            for (size_t i = 0; i < size; ++i)
+            {
+                assert(names[i].find(" with key " + std::to_string(keys[i])) != std::string::npos);
+                assert(!i || keys[i - 1] <= keys[i]);
+            }
         }
 
-        while (value >= Base)
         {
-            value /= Base;
-            ++digits;
+            RadixSorter<Event, 256, decltype(&Event::ts)> sort(&Event::ts);
+            sort.chatGpt = chatGpt;
+            sort.inPlace = inPlace;
+            sort.parallel = parallel;
+            sort.parallelThreshold = 64;
+            auto const sorted = sort(events.begin(), events.end());
+
+            auto expected = events;
+            std::stable_sort(expected.begin(), expected.end(), [](Event const & a, Event const & b) { return a.ts < b.ts; });
+            for (size_t i = 0; i < size; ++i)
+            {
+                assert(sorted[i].ts == expected[i].ts);
+                std::string const suffix = " at " + std::to_string(sorted[i].ts);
+                assert(sorted[i].name.size() > suffix.size());
+                assert(sorted[i].name.compare(sorted[i].name.size() - suffix.size(), suffix.size(), suffix) == 0);
+                assert(inPlace || sorted[i].name == expected[i].name);
+            }
+
+            sort.sort(events.data(), size);
+            for (size_t i = 0; i < size; ++i)
+                assert(events[i].ts == expected[i].ts && (inPlace || events[i].name == expected[i].name));
         }
+    }
+}
 
-        return digits;
+// Sort strings, string_views and (pointer, length) pairs, and compare with std::sort.
+// Include empty strings, embedded zeros, high bytes, and prefixes longer than
+// the 8 cached bytes.
+void TestStrings()
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937 engine(1357);
+
+    {
+        std::vector<std::string> data{"b", "", "ab", std::string("ab\0", 3), "abc", "a", "", "\xff", "ab"};
+        std::vector<std::string> expected = data;
+        std::sort(expected.begin(), expected.end());
+        StringRadixSorter sort;
+        sort(data.begin(), data.end());
+        assert(data == expected);
     }
 
-    static int64_t get_power(unsigned n)
+    for (size_t size : {0, 1, 2, 31, 33, 100, 3000})
     {
-        int64_t value = 1;
-        while (n > 0)
+        for (int alphabet : {2, 26, 256})
         {
-            n -= 1;
-            value *= Base;
+            std::vector<std::string> strings(size);
+            for (auto& s : strings)
+            {
+                // Long shared prefixes, so the cached prefix is refilled.
+                s = std::string(engine() % 20, 'x');
+                size_t const length = engine() % 12;
+                for (size_t i = 0; i < length; ++i)
+                    s += static_cast<char>((alphabet == 256) ? engine() % 256 : 'a' + engine() % alphabet);
+            }
+            auto expected = strings;
+            std::sort(expected.begin(), expected.end());
+
+            for (size_t threshold : {0, 4, 32})
+            {
+                StringRadixSorter sort;
+                sort.quicksortThreshold = threshold;
+
+                auto data = strings;
+                sort(data.begin(), data.end());
+                assert(data == expected);
+
+                std::vector<std::string_view> views(strings.begin(), strings.end());
+                sort(views.begin(), views.end());
+                for (size_t i = 0; i < size; ++i)
+                    assert(views[i] == expected[i]);
+
+                std::vector<std::pair<const char*, size_t>> pairs;
+                for (auto const& s : strings)
+                    pairs.emplace_back(s.data(), s.size());
+                sort(pairs.begin(), pairs.end());
+                for (size_t i = 0; i < size; ++i)
+                    assert(std::string_view(pairs[i].first, pairs[i].second) == expected[i]);
+            }
         }
-        return value;
     }
+}
+
+// sort and sort_to, with and without scratch, against operator().
+template <typename T, int64_t Base>
+void TestCallerBuffers(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(97531);
 
-    T get_digit(T value, int64_t power)
+    for (size_t size : {0, 1, 2, 50, 999, 5000})
     {
-        if (handleNegativeNumbers)
-            return (value < 0) ? (Base - ((value / -power) % Base)) : (Base + ((value / power) % Base));
-        return (value / power) % Base;
+        std::vector<T> orig(size);
+        for (auto& value : orig)
+            value = static_cast<T>(engine() >> (engine() % 64));
+
+        RadixSorter<T, Base> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 64;
+        auto expected = orig;
+        std::sort(expected.begin(), expected.end());
+
+        assert(sort(orig.begin(), orig.end()) == expected);
+
+        std::vector<T> scratch(size);
+        std::vector<T> out(size);
+
+        auto data = orig;
+        sort.sort(data.data(), size);
+        assert(data == expected);
+
+        data = orig;
+        sort.sort(data.data(), size, scratch.data());
+        assert(data == expected);
+
+        sort.sort_to(orig.data(), size, out.data());
+        assert(out == expected);
+
+        std::fill(out.begin(), out.end(), T());
+        sort.sort_to(orig.data(), size, out.data(), scratch.data());
+        assert(out == expected);
+
+#if __cpp_lib_span
+        data = orig;
+        sort.sort(std::span<T>(data));
+        assert(data == expected);
+
+        data = orig;
+        sort.sort(std::span<T>(data), std::span<T>(scratch));
+        assert(data == expected);
+
+        std::fill(out.begin(), out.end(), T());
+        sort.sort_to(orig, out, scratch);
+        assert(out == expected);
+#endif
     }
+}
+
+// The arena grows, coalesces, is reused without growing, and trims.
+void TestScratchArena(bool chatGpt, bool inPlace, bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
 
-    void helper(
-        T* data,
-        T* temp,
-        size_t size,
-        int64_t max_digits,
-        int64_t power)
     {
-        if (size >= 2 && power >= 1)
+        ScratchArena arena;
+        {
+            ScratchArena::Scope scope(arena);
+            int* const a = arena.allocate<int>(100);
+            {
+                ScratchArena::Scope inner(arena);
+                double* const b = arena.allocate<double>(1000);
+                assert(reinterpret_cast<uintptr_t>(b) % 64 == 0);
+                b[999] = 1;
+            }
+            // The inner allocation is free again, and reused.
+            double* const c = arena.allocate<double>(1000);
+            c[0] = a[0] = 1;
+            assert(arena.capacity() > 1000 * sizeof(double));
+        }
+        // One block, as large as all of them, is kept.
+        size_t const capacity = arena.capacity();
         {
-            using array = std::array<size_t, Base * 2>;
+            ScratchArena::Scope scope(arena);
+            arena.allocate<int>(100);
+            arena.allocate<double>(1000);
+        }
+        assert(arena.capacity() == capacity);
 
-            array positions{};
-            array counts{};
-            size_t i{};
-            size_t position{};
+        arena.trimThreshold = 100;
+        {
+            ScratchArena::Scope scope(arena);
+            arena.allocate<int>(100);
+        }
+        assert(arena.capacity() == 0);
+    }
 
-            // count them
-            for (i = 0; i < size; ++i)
-                counts[get_digit(data[i], power)] += 1;
+    std::mt19937 engine(86420);
+    std::vector<int> orig(5000);
+    for (auto& value : orig)
+        value = static_cast<int>(engine());
 
-            // compute range starts
-            for (i = 0; i < Base * 2; ++i)
-            {
-                positions[i] = position;
-                position += counts[i];
-            }
+    for (int thread_arena = 0; thread_arena <= 1; ++thread_arena)
+    {
+        RadixSorter<int, 256> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 64;
+        sort.threadArena = thread_arena;
+        auto& arena = thread_arena ? ScratchArena::thread_default() : sort.arena;
+
+        auto data = orig;
+        sort.sort(data.data(), data.size());
+        assert(std::is_sorted(data.begin(), data.end()));
+        size_t const capacity = arena.capacity();
+        assert(inPlace || capacity >= orig.size() * sizeof(int));
+
+        // Sorting by key needs more, then sorting again reuses the memory.
+        std::vector<uint32_t> ids(orig.size());
+        data = orig;
+        sort.sort_by_key(data.data(), data.size(), ids.data());
+        size_t const capacity2 = arena.capacity();
+        assert(capacity2 >= capacity);
+        data = orig;
+        sort.sort(data.data(), data.size());
+        assert(std::is_sorted(data.begin(), data.end()));
+        sort.sort_by_key(data.data(), data.size(), ids.data());
+        assert(arena.capacity() == capacity2);
+        assert(thread_arena || ScratchArena::thread_default().capacity() == 0);
+    }
+}
 
-            {
-                auto current_position = positions;
+// Write data to a file, sort it out of core with little memory,
+// and compare with sorting in memory.
+template <typename T>
+void TestExternalSort(std::vector<T> const & data, size_t memory_limit, bool parallel)
+{
+    char const * const input = "radix_sort_test_input.bin";
+    char const * const output = "radix_sort_test_output.bin";
+
+    // The I/O is outside assert, so it still happens under NDEBUG.
+    FILE* file = fopen(input, "wb");
+    assert(file);
+    size_t const written = data.empty() ? 0 : fwrite(data.data(), sizeof(T), data.size(), file);
+    assert(written == data.size());
+    fclose(file);
+
+    ExternalRadixSorter<T> sort;
+    sort.memoryLimit = memory_limit;
+    sort.sorter.parallel = parallel;
+    bool const ok = sort.sort_file(input, output);
+    assert(ok);
+
+    std::vector<T> sorted(data.size() + 1);
+    file = fopen(output, "rb");
+    assert(file);
+    size_t const read = fread(sorted.data(), sizeof(T), sorted.size(), file);
+    assert(read == data.size());
+    fclose(file);
+    sorted.pop_back();
+    remove(input);
+    remove(output);
+
+    RadixSorter<T, 256> memory_sort;
+    auto const expected = memory_sort(data.begin(), data.end());
+    assert(data.empty() || memcmp(sorted.data(), expected.data(), sizeof(T) * data.size()) == 0);
+
+    // Two reads and two writes, unless a bucket was too large.
+    if (data.size() * sizeof(T) <= memory_limit / 2)
+        assert(sort.bytesRead == data.size() * sizeof(T) && sort.runs == 0);
+    printf("external size:%zu read:%llu written:%llu runs:%zu\n", data.size(),
+        (unsigned long long)sort.bytesRead, (unsigned long long)sort.bytesWritten, sort.runs);
+}
 
-                // place them in ranges
-                for (i = 0; i < size; ++i)
-                {
-                    const T& d = data[i];
-                    const T digit = get_digit(d, power);
-                    temp[current_position[digit]] = d;
-                    current_position[digit] += 1;
-                }
-            }
+void TestExternalSorts(bool parallel)
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(24680);
 
-            // temp is now partially sorted (more than data)
-            // swap temp and data
-            // sort ranges
+    for (size_t size : {0, 1, 100, 20000})
+    {
+        // Full range, so the top digit splits evenly.
+        std::vector<int64_t> wide(size);
+        for (auto& value : wide)
+            value = static_cast<int64_t>(engine());
+        TestExternalSort(wide, 1 << 16, parallel);
+        TestExternalSort(wide, 1 << 30, parallel);
+
+        // Small values, all in the top digit's bucket 0 and 255,
+        // and many equal, so buckets are sorted out of core, or copied.
+        std::vector<int64_t> narrow(size);
+        for (auto& value : narrow)
+            value = static_cast<int64_t>(engine() % 3000) - 1000 + ((engine() & 1) ? 0 : 7);
+        TestExternalSort(narrow, 1 << 12, parallel);
+
+        std::vector<double> doubles(size);
+        for (auto& value : doubles)
+            value = std::uniform_real_distribution<double>(-1e6, 1e6)(engine);
+        TestExternalSort(doubles, 1 << 12, parallel);
+
+        std::vector<uint32_t> equal(size, 42);
+        TestExternalSort(equal, 1 << 10, parallel);
+    }
+}
 
-            if (power > 1)
-            {
-                for (i = 0; i < Base * 2; ++i)
-                {
-                    auto const offset = positions[i];
-                    // Recursive depth is limited by log of the largest magintude data.
-                    helper(temp + offset, data + offset, counts[i], max_digits - 1, power / Base);
-                }
-            }
+// Write data to a file in either byte order, sort it through mmap, and check it.
+template <typename T>
+void TestFileSort(const char* type, std::vector<T> data, bool big_endian, bool chatGpt, bool inPlace, bool parallel)
+{
+    char const * const path = "radix_sort_test_mapped.bin";
+    bool const swap = big_endian == host_is_little_endian();
+
+    RadixSorter<T, 256> memory_sort;
+    auto const expected = memory_sort(data.begin(), data.end());
+
+    if (swap)
+        byte_swap(data.data(), data.size());
+    // The I/O is outside assert, so it still happens under NDEBUG.
+    FILE* file = fopen(path, "wb");
+    assert(file);
+    size_t const written = data.empty() ? 0 : fwrite(data.data(), sizeof(T), data.size(), file);
+    assert(written == data.size());
+    fclose(file);
+
+    FileSortOptions options;
+    options.bigEndian = big_endian;
+    options.chatGpt = chatGpt;
+    options.inPlace = inPlace;
+    options.parallel = parallel;
+    bool const ok = sort_file_in_place(path, type, options);
+    assert(ok);
+
+    file = fopen(path, "rb");
+    assert(file);
+    size_t const read = data.empty() ? 0 : fread(data.data(), sizeof(T), data.size(), file);
+    assert(read == data.size());
+    fclose(file);
+    remove(path);
+
+    if (swap)
+        byte_swap(data.data(), data.size());
+    assert(data.empty() || memcmp(data.data(), expected.data(), sizeof(T) * data.size()) == 0);
+}
+
+void TestFileSorts(bool chatGpt, bool inPlace, bool parallel)
+{
+#if !_WIN32
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(11235);
+
+    for (size_t size : {0, 1, 2, 1000, 70000})
+    {
+        std::vector<int64_t> int64s(size);
+        std::vector<uint32_t> uint32s(size);
+        std::vector<float> floats(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            int64s[i] = static_cast<int64_t>(engine());
+            uint32s[i] = static_cast<uint32_t>(engine());
+            floats[i] = std::uniform_real_distribution<float>(-1e6, 1e6)(engine);
         }
-        else
+
+        for (int big_endian = 0; big_endian <= 1; ++big_endian)
         {
-            // Recursion depth is limited to max_digits, but also stops when size==1.
-            // Copy is needed if size==1 an odd number of times before the maximum recursion.
-            // That is, we could recurse till max_digits == 0, but that would only
-            // move elements back and forth between data and temp. Instead, do one
-            // last copy and stop recursing. Well, odd vs. even is empirically derived,
-            // to fix off by one.
-            if (!(max_digits & 1))
-                std::copy(data, data + size, temp);
+            TestFileSort("int64", int64s, big_endian, chatGpt, inPlace, parallel);
+            TestFileSort("uint32", uint32s, big_endian, chatGpt, inPlace, parallel);
+            TestFileSort("float", floats, big_endian, chatGpt, inPlace, parallel);
         }
     }
-    
-    friend int main(int argc, char** argv);;
-};
 
+    // Missing file, unknown type.
+    FileSortOptions options;
+    assert(!sort_file_in_place("radix_sort_test_missing.bin", "int64", options));
+    assert(!sort_file_in_place("radix_sort_test_missing.bin", "int16", options));
+#endif
+}
+
+// Write combined scatters, with and without streaming stores, sort the same as plain ones.
 template <typename T, int64_t Base>
-class TestRadixSorter : public RadixSorter<T, Base>
+void TestWriteCombining(bool chatGpt, bool inPlace, bool parallel)
 {
-public:
-    template <typename Iterator>
-    std::vector<T> operator()(bool reverse, Iterator begin, Iterator end)
-    {
-        if (reverse)
-            std::reverse(begin, end);
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(31415);
 
-        auto const sorted = RadixSorter<T, Base>::operator()(begin, end);
-        assert(sorted.size() == (end - begin));
-        if (sorted.size() <= 10)
-            verbose(sorted.begin(), sorted.end());
-        check(sorted.begin(), sorted.end());
-        return sorted;
+    for (size_t size : {2, 100, 3000})
+    {
+        std::vector<T> data(size);
+        for (auto& value : data)
+            value = static_cast<T>(engine() >> (engine() % 64));
+
+        RadixSorter<T, Base> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 64;
+        sort.scatterOptions.writeCombiningThreshold = SIZE_MAX;
+        auto const expected = sort(data.begin(), data.end());
+        assert(std::is_sorted(expected.begin(), expected.end()));
+
+        for (size_t streaming : {size_t(0), SIZE_MAX})
+        {
+            sort.scatterOptions.writeCombiningThreshold = 0;
+            sort.scatterOptions.streamingBytes = streaming;
+            sort.scatterOptions.msdStreamingBytes = streaming;
+            assert(sort(data.begin(), data.end()) == expected);
+
+            // Unaligned output.
+            std::vector<T> out(size + 1);
+            sort.sort_to(data.data(), size, out.data() + 1);
+            assert(std::equal(expected.begin(), expected.end(), out.begin() + 1));
+        }
     }
+}
 
-    template <typename Iterator>
-    void verbose(Iterator begin, Iterator end, bool success = true)
+// Multi-table and SIMD histograms count the same as the plain loop,
+// at every level this CPU supports, for every digit at once, on
+// sorted, constant, random, and negative data, with sizes that leave tails.
+template <typename T, int64_t Base>
+void TestHistograms()
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(27182);
+    constexpr size_t BaseBits = log2_base<Base>;
+
+    for (size_t size : {size_t(5), size_t(2047), size_t(2048), size_t(10007)})
     {
-        auto ToChar = [](int a)
+        for (int kind = 0; kind < 4; ++kind)
         {
-            return (a > 0 && a < 128 && isprint(a)) ? a : '?';
-        };
+            std::vector<T> data(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (kind == 0)
+                    data[i] = static_cast<T>(i);
+                else if (kind == 1)
+                    data[i] = static_cast<T>(42);
+                else if (kind == 2)
+                    data[i] = static_cast<T>(engine());
+                else
+                    data[i] = static_cast<T>(static_cast<int64_t>(engine() % 2001) - 1000);
+            }
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                if (kind == 2)
+                    for (auto& value : data)
+                        value = static_cast<T>(static_cast<int64_t>(engine()) * 1e-9);
+            }
 
-        if (!success) printf("%s\n", success ? "success" : "failed");
-        for (auto it{begin}; it != end; ++it)
-            printf("%d %c ", (int)*it, ToChar(*it));
-        assert(success);
+            auto const key = get_radix_key(data.begin(), data.end()).first;
+            using K = typename decltype(key)::type;
+            std::vector<K> powers;
+            for (size_t shift = 0; shift < sizeof(K) * CHAR_BIT; shift += BaseBits)
+                powers.push_back(static_cast<K>(shift));
+
+            std::vector<std::array<size_t, Base>> expected(powers.size());
+            for (auto const& value : data)
+                for (size_t d = 0; d < powers.size(); ++d)
+                    expected[d][(key(value) >> powers[d]) & (Base - 1)] += 1;
+
+            for (int level = 0; level <= (int)simd_level(); ++level)
+            {
+                std::vector<std::array<size_t, Base>> counts(powers.size());
+                count_digits_into<Base>(data.data(), size, key, powers.data(), powers.size(), counts.data(), SimdLevel(level));
+                assert(counts == expected);
+
+                // One digit, as RadixSorter::histogram counts, adding to what is there.
+                std::array<size_t, Base> top{};
+                top[0] = 1;
+                count_digits_into<Base>(data.data(), size, key, &powers.back(), 1, &top, SimdLevel(level));
+                top[0] -= 1;
+                assert(top == expected.back());
+            }
+        }
     }
+}
 
-    template <typename Iterator>
-    void check(Iterator begin, Iterator end)
+// The fused copy and statistics pass, at every level this CPU supports,
+// agrees with computing each statistic alone, and copies exactly.
+template <typename T>
+void TestKeyStats()
+{
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(16180);
+
+    for (size_t size : {size_t(1), size_t(7), size_t(33), size_t(1000)})
     {
-        auto previous{begin};
-        for (auto it{begin}; it != end; ++it)
+        for (int kind = 0; kind < 3; ++kind)
         {
-            if (it != begin)
+            std::vector<T> data(size);
+            for (auto& value : data)
             {
-                if (!(*previous++ <= *it))
-                {
-                    verbose(begin, end, false);
-                    return;
-                }
+                if constexpr (std::is_floating_point_v<T>)
+                    value = static_cast<T>(static_cast<int64_t>(engine() >> (engine() % 64)) * ((kind == 0) ? 1e-3 : -1e-3));
+                else if (kind == 0)
+                    value = static_cast<T>(engine() >> 40);
+                else
+                    value = static_cast<T>(engine() >> (engine() % 64));
+            }
+            if (kind == 2)
+                data[size / 2] = std::numeric_limits<T>::lowest();
+
+            bool negatives = false;
+            if constexpr (!std::is_floating_point_v<T>)
+                negatives = *std::min_element(data.begin(), data.end()) < 0;
+            RadixKey<T> const expected_key(negatives);
+            KeyStats<typename RadixKey<T>::type> expected;
+            for (auto const& value : data)
+                expected.add(expected_key(value));
+
+            for (int level = 0; level <= (int)simd_level(); ++level)
+            {
+                std::vector<T> copy(size + 1);
+                auto const [key, stats] = get_key_stats(data.data(), size, copy.data() + 1, Identity{}, SimdLevel(level));
+                assert(memcmp(copy.data() + 1, data.data(), size * sizeof(T)) == 0);
+                assert(stats.min == expected.min);
+                assert(stats.max == expected.max);
+                assert(stats.bit_or == expected.bit_or);
+                assert(stats.bit_and == expected.bit_and);
+                for (auto const& value : data)
+                    assert(key(value) == expected_key(value));
+
+                auto const [key2, stats2] = get_key_stats<T>(data.data(), size, nullptr, Identity{}, SimdLevel(level));
+                assert(stats2.max == expected.max && stats2.min == expected.min);
             }
         }
     }
-};
+}
 
-void Benchmark(size_t size)
+// Narrow ranges of large numbers, like epoch timestamps and ids,
+// sort only the digits of their spread, see rebase_key.
+template <typename T, int64_t Base>
+void TestRangeCompression(bool chatGpt, bool inPlace, bool parallel)
 {
-    std::vector<int> orig(size, 0);
-    std::vector<int> data(size, 0);
-
-    for (size_t i = 0; i < size; ++i)
-        orig[i] = (0x7fffffff & rand());
-
-    TestRadixSorter<int, 16> test_sort;
+    printf("\nline:%d\n", __LINE__);
+    std::mt19937_64 engine(14142);
 
-    data = orig;
-    time_t start_ChatGpt = time(0);
-    test_sort.chatGpt = true;
-    test_sort(false, &data[0], &data[size]);
-    time_t end_ChatGpt = time(0);
+    for (T const base : {T(1700000000000), T(-1700000000000), std::numeric_limits<T>::max() - T(70000), std::numeric_limits<T>::lowest()})
+    {
+        std::vector<T> data(5000);
+        for (auto& value : data)
+            value = static_cast<T>(base + static_cast<T>(engine() % 65536));
+        data[0] = base;
+        data[1] = static_cast<T>(base + 65535);
+
+        RadixSorter<T, Base> sort;
+        sort.chatGpt = chatGpt;
+        sort.inPlace = inPlace;
+        sort.parallel = parallel;
+        sort.parallelThreshold = 256;
+        auto const sorted = sort(data.begin(), data.end());
+        auto expected = data;
+        std::sort(expected.begin(), expected.end());
+        assert(sorted == expected);
+
+        // Two digits of 256, both of which differ, so none skipped, of the 8 of T.
+        if (Base == 256)
+            assert(sort.skippedPasses == 0);
+    }
 
-    data = orig;
-    time_t start_NoChatGpt = time(0);
-    test_sort.chatGpt = false;
-    test_sort(false, &data[0], &data[size]);
-    time_t end_NoChatGpt = time(0);
+    // A projection, and payloads, are sorted by the rebased key too.
+    std::vector<T> keys(3000);
+    std::vector<uint32_t> ids(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        keys[i] = static_cast<T>(T(1) << 50) + static_cast<T>(engine() % 1000);
+        ids[i] = static_cast<uint32_t>(i);
+    }
+    auto const original = keys;
+    RadixSorter<T, Base> sort;
+    sort.chatGpt = chatGpt;
+    sort.parallel = parallel;
+    sort.sort_by_key(keys.data(), keys.size(), ids.data());
+    assert(std::is_sorted(keys.begin(), keys.end()));
+    for (size_t i = 0; i < keys.size(); ++i)
+        assert(original[ids[i]] == keys[i]);
+    for (size_t i = 1; i < keys.size(); ++i)
+        assert(keys[i - 1] < keys[i] || ids[i - 1] < ids[i]);
+}
 
-    printf("noChatGpt:%d\n", (int)(end_NoChatGpt - start_NoChatGpt));
-    printf("chatGpt:%d\n",   (int)(end_ChatGpt - start_ChatGpt));
+// Level names round trip, and RADIX_SORT_SIMD can only lower the level.
+void TestSimdDispatch()
+{
+    printf("\nline:%d\n", __LINE__);
+    for (auto level : {SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512})
+    {
+        SimdLevel parsed{};
+        assert(parse_simd_level(simd_level_name(level), parsed));
+        assert(parsed == level);
+    }
+    SimdLevel parsed = SimdLevel::Avx2;
+    assert(!parse_simd_level("avx3", parsed));
+    assert(parsed == SimdLevel::Avx2);
+    assert(simd_level() <= cpu_simd_level());
+    printf("simd:%s cpu:%s\n", simd_level_name(simd_level()), simd_level_name(cpu_simd_level()));
 }
 
 int main(int argc, char** argv)
 {
     bool chatGpt = false;
     bool benchmark = false;
-    bool handleNegativeNumbers = false;
+    bool inPlace = false;
+    bool parallel = false;
     uint64_t benchmark_size = 999999;
+    const char* sort_file = nullptr;
+    const char* sort_file_type = nullptr;
+    FileSortOptions file_options;
 
     while (*++argv)
     {
@@ -397,8 +2529,27 @@ int main(int argc, char** argv)
             chatGpt = false;
         else if (strcmp(*argv, "benchmark") == 0)
             benchmark = true;
-        else if (strcmp(*argv, "handlenegativenumbers") == 0)
-            handleNegativeNumbers = true;
+        else if (strcmp(*argv, "inplace") == 0)
+            inPlace = true;
+        else if (strcmp(*argv, "parallel") == 0)
+            parallel = true;
+        else if (strcmp(*argv, "sortfile") == 0)
+        {
+            // sortfile path type [little|big]
+            if (!argv[1] || !argv[2])
+            {
+                printf("usage: sortfile path int32|uint32|int64|uint64|float|double [little|big]\n");
+                return 1;
+            }
+            sort_file = argv[1];
+            sort_file_type = argv[2];
+            argv += 2;
+            if (argv[1] && (strcmp(argv[1], "big") == 0 || strcmp(argv[1], "little") == 0))
+            {
+                file_options.bigEndian = (strcmp(argv[1], "big") == 0);
+                ++argv;
+            }
+        }
         else if (strcmp(*argv, "benchmark_size") == 0 && argv[1])
         {
             uint64_t max = std::numeric_limits<uint64_t>::max();
@@ -428,10 +2579,10 @@ int main(int argc, char** argv)
 
     if (chatGpt)
     {
-        if (handleNegativeNumbers)
+        if (inPlace)
         {
-            printf("chatGpt:handleNegativeNumbers = false");
-            handleNegativeNumbers = false;
+            printf("chatGpt:inPlace = false");
+            inPlace = false;
         }
     }
 
@@ -441,6 +2592,14 @@ int main(int argc, char** argv)
         return 0;
     }
 
+    if (sort_file)
+    {
+        file_options.chatGpt = chatGpt;
+        file_options.inPlace = inPlace;
+        file_options.parallel = parallel;
+        return sort_file_in_place(sort_file, sort_file_type, file_options) ? 0 : 1;
+    }
+
 
     {
         int data[] = {-9,-4,4,2,0};
@@ -453,36 +2612,23 @@ int main(int argc, char** argv)
     {
         constexpr int Base{10};
         RadixSorter<int, Base> sort;
-        if (sort.handleNegativeNumbers)
-        {
-            assert(sort.get_digit(1234, 1) == Base + 4);
-            assert(sort.get_digit(1234, 10) == Base + 3);
-            assert(sort.get_digit(1234, 100) == Base + 2);
-            assert(sort.get_digit(1234, 1000) == Base + 1);
-            assert(sort.get_digit(1234, 10000) == Base + 0);
-            assert(sort.get_digit(0, 1) == Base);
-            assert(sort.get_digit(0, 10) == Base);
-            assert(sort.get_digit(0, 100) == Base);
-            assert(sort.get_digit(0, 1000) == Base);
-            assert(sort.get_digit(-1234, 1) == Base - 4);
-            assert(sort.get_digit(-1234, 10) == Base - 3);
-            assert(sort.get_digit(-1234, 100) == Base - 2);
-            assert(sort.get_digit(-1234, 1000) == Base - 1);
-            assert(sort.get_digit(-9234, 1000) == Base - 9);
-            assert(sort.get_digit(-1234, 10000) == Base - 0);
-        }
-        else
-        {
-            assert(sort.get_digit(1234, 1) == 4);
-            assert(sort.get_digit(1234, 10) == 3);
-            assert(sort.get_digit(1234, 100) == 2);
-            assert(sort.get_digit(1234, 1000) == 1);
-            assert(sort.get_digit(1234, 10000) == 0);
-            assert(sort.get_digit(0, 1) == 0);
-            assert(sort.get_digit(0, 10) == 0);
-            assert(sort.get_digit(0, 100) == 0);
-            assert(sort.get_digit(0, 1000) == 0);
-        }
+        assert(sort.get_digit(1234, 1) == 4);
+        assert(sort.get_digit(1234, 10) == 3);
+        assert(sort.get_digit(1234, 100) == 2);
+        assert(sort.get_digit(1234, 1000) == 1);
+        assert(sort.get_digit(1234, 10000) == 0);
+        assert(sort.get_digit(0, 1) == 0);
+        assert(sort.get_digit(0, 10) == 0);
+        assert(sort.get_digit(0, 100) == 0);
+        assert(sort.get_digit(0, 1000) == 0);
+
+        // With negative numbers, digits are of the key with the sign bit flipped.
+        // 0x80000000 + 1234 = 2147484882, 0x80000000 - 1234 = 2147482414
+        sort.key = SignFlipKey<int>(true);
+        assert(sort.get_digit(1234, 1) == 2);
+        assert(sort.get_digit(1234, 10) == 8);
+        assert(sort.get_digit(-1234, 1) == 4);
+        assert(sort.get_digit(-1234, 10) == 1);
 
         assert(sort.get_digits(4) == 1);
         assert(sort.get_digits(34) == 2);
@@ -496,18 +2642,62 @@ int main(int argc, char** argv)
         assert(sort.get_digits(-1234) == 4);
     }
 
+    {
+        // Power of two base uses shift and mask, power is a shift.
+        RadixSorter<int, 16> sort;
+        assert(sort.get_digit(0x1234, 0) == 4);
+        assert(sort.get_digit(0x1234, 4) == 3);
+        assert(sort.get_digit(0x1234, 8) == 2);
+        assert(sort.get_digit(0x1234, 12) == 1);
+        assert(sort.get_digit(0x1234, 16) == 0);
+
+        assert(sort.get_digits(0) == 1);
+        assert(sort.get_digits(0xf) == 1);
+        assert(sort.get_digits(0x10) == 2);
+        assert(sort.get_digits(0x1234) == 4);
+        assert(sort.get_digits(-0xf) == 1);
+        assert(sort.get_digits(-0x10) == 2);
+        assert(sort.get_digits(-0x1234) == 4);
+        assert(sort.get_digits(std::numeric_limits<int>::min()) == 8);
+
+        assert(sort.get_power(1) == 0);
+        assert(sort.get_power(4) == 12);
+        assert(sort.next_power(12) == 8);
+
+        sort.key = SignFlipKey<int>(true);
+        assert(sort.get_digit(0x1234, 4) == 3);
+        assert(sort.get_digit(0x1234, 28) == 8);
+        assert(sort.get_digit(-1, 0) == 0xf);
+        assert(sort.get_digit(-1, 28) == 7);
+        assert(sort.get_digit(std::numeric_limits<int>::min(), 28) == 0);
+
+        SignFlipKey<int> const key(true);
+        assert(key(std::numeric_limits<int>::min()) == 0);
+        assert(key(-1) < key(0));
+        assert(key(0) < key(1));
+        assert(key(std::numeric_limits<int>::max()) == 0xffffffff);
+        assert(SignFlipKey<short>(true)(-1) == 0x7fff);
+        assert(SignFlipKey<unsigned>(true)(1) == 1);
+    }
+
     { // ChatGPT fork.
         assert(get_digit<10>(1234, 1) == 4);
         assert(get_digit<10>(1234, 10) == 3);
         assert(get_digit<10>(1234, 100) == 2);
         assert(get_digit<10>(1234, 1000) == 1);
         assert(get_digit<10>(1234, 10000) == 0);
+
+        assert(get_digit<16>(0x1234, 0) == 4);
+        assert(get_digit<16>(0x1234, 4) == 3);
+        assert(get_digit<16>(0x1234, 12) == 1);
+        assert(get_digit<16>(0x1234, 16) == 0);
     }
 
     constexpr int Base{10};
     TestRadixSorter<int, Base> test_sort;
     test_sort.chatGpt = chatGpt;
-    test_sort.handleNegativeNumbers = handleNegativeNumbers;
+    test_sort.inPlace = inPlace;
+    test_sort.parallel = parallel;
 
     for (int reverse = 0; reverse <= 1; ++reverse)
     {
@@ -578,7 +2768,6 @@ int main(int argc, char** argv)
             test_sort(reverse, data.begin(), data.end());
         }
 
-        if (!chatGpt && test_sort.handleNegativeNumbers)
         {
             printf("\nline:%d\n", __LINE__);
             std::vector<int> data{9,-8,7,-1,2,-3,1000,-100,1234,-5678,1234,-5678};
@@ -597,6 +2786,28 @@ int main(int argc, char** argv)
             test_sort(reverse, data.begin(), data.end());
         }
 
+        {
+            // Leading digits that are the same in every element are not sorted,
+            // because the min is subtracted first, see rebase_key.
+            // Here the top six hex digits are, leaving two, which differ.
+            printf("\nline:%d\n", __LINE__);
+            TestRadixSorter<int, 16> test_sort;
+            test_sort.chatGpt = chatGpt;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
+            test_sort.insertionSortThreshold = 0;
+            std::vector<int> data{0x5A000003, 0x5A000001, 0x5A000002, 0x5A000010};
+            test_sort(reverse, data.begin(), data.end());
+            assert(test_sort.skippedPasses == 0);
+
+            // Digits within the spread that are the same in every element are skipped.
+            // Less the min, these are 2, 0, 1 and 0x100000, and four
+            // hex digits between the top one and the last are all 0.
+            data = {0x5A000003, 0x5A000001, 0x5A000002, 0x5A100001};
+            test_sort(reverse, data.begin(), data.end());
+            assert(test_sort.skippedPasses == 4);
+        }
+
         // Some bases/types/values interact poorly.
         // For example in base 4, the value 64 cannot represent
         // lower case letters, but the next value
@@ -606,7 +2817,8 @@ int main(int argc, char** argv)
             constexpr int Base = 2;
             TestRadixSorter<short, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -617,7 +2829,8 @@ int main(int argc, char** argv)
             constexpr int Base = 3;
             TestRadixSorter<short, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -628,7 +2841,8 @@ int main(int argc, char** argv)
             constexpr int Base = 8;
             TestRadixSorter<short, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -639,7 +2853,8 @@ int main(int argc, char** argv)
             constexpr int Base = 9;
             TestRadixSorter<short, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -650,7 +2865,8 @@ int main(int argc, char** argv)
             constexpr int Base = 10;
             TestRadixSorter<short, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -661,7 +2877,8 @@ int main(int argc, char** argv)
             constexpr int Base = 2;
             TestRadixSorter<unsigned char, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             unsigned char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -672,7 +2889,8 @@ int main(int argc, char** argv)
             constexpr int Base = 3;
             TestRadixSorter<unsigned char, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             unsigned char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -683,7 +2901,8 @@ int main(int argc, char** argv)
             constexpr int Base = 8;
             TestRadixSorter<unsigned char, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             unsigned char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -694,7 +2913,8 @@ int main(int argc, char** argv)
             constexpr int Base = 9;
             TestRadixSorter<unsigned char, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             unsigned char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
@@ -705,95 +2925,150 @@ int main(int argc, char** argv)
             constexpr int Base = 10;
             TestRadixSorter<unsigned char, Base> test_sort;
             test_sort.chatGpt = chatGpt;
-            test_sort.handleNegativeNumbers = handleNegativeNumbers;
+            test_sort.inPlace = inPlace;
+            test_sort.parallel = parallel;
             unsigned char data[] = "foobar";
             auto const sorted = test_sort(reverse, data, std::end(data));
             assert(sorted.size() == 7);
         }
 
-        // StackOverflow for random number generation.
-        // ChatGPT code does not handle negative numbers
-        using T = int32_t; // TODO: int64_t and uint64_t should work
-        std::random_device dev;
-        std::mt19937 engine(dev());
-        std::uniform_int_distribution<T> distribution(
-            handleNegativeNumbers ? std::numeric_limits<T>::min() : 0,
-            std::numeric_limits<T>::max());
-
-        // random data
-        printf("\nline:%d\n", __LINE__);
-        for (int size = 2; size < 999; ++size)
         {
-            T data[999]{};
-            for (int index = 0; index < size; ++index)
-            {
-                data[index] = distribution(engine);
-                assert(handleNegativeNumbers || data[index] >= 0);
-            }
-
-            {
-                TestRadixSorter<T, 2> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+            // Floating point. -0.0 sorts before 0.0, NaN by its sign bit.
+            printf("\nline:%d\n", __LINE__);
+            double const inf = std::numeric_limits<double>::infinity();
+            double const nan = std::numeric_limits<double>::quiet_NaN();
+            std::vector<double> data{1.5, -0.0, nan, -inf, 0.0, inf, -2.5, -nan, 1e-300, -1e300};
+            std::vector<double> const expected{-nan, -inf, -1e300, -2.5, -0.0, 0.0, 1e-300, 1.5, inf, nan};
+            if (reverse)
+                std::reverse(data.begin(), data.end());
+            RadixSorter<double, 256> sort;
+            sort.chatGpt = chatGpt;
+            sort.inPlace = inPlace;
+            sort.parallel = parallel;
+            auto const sorted = sort(data.begin(), data.end());
+            assert(memcmp(&sorted[0], &expected[0], sizeof(double) * expected.size()) == 0);
+
+            sort.insertionSortThreshold = 0;
+            auto const sorted2 = sort(data.begin(), data.end());
+            assert(memcmp(&sorted2[0], &expected[0], sizeof(double) * expected.size()) == 0);
+
+            std::vector<float> fdata(data.begin(), data.end());
+            std::vector<float> const fexpected(expected.begin(), expected.end());
+            RadixSorter<float, 16> fsort;
+            fsort.chatGpt = chatGpt;
+            fsort.inPlace = inPlace;
+            fsort.parallel = parallel;
+            auto const fsorted = fsort(fdata.begin(), fdata.end());
+            assert(memcmp(&fsorted[0], &fexpected[0], sizeof(float) * fexpected.size()) == 0);
+        }
 
-            {
-                TestRadixSorter<T, 3> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+        {
+            // Random floating point.
+            printf("\nline:%d\n", __LINE__);
+            std::mt19937 engine(1234);
+            std::uniform_real_distribution<double> distribution(-1e9, 1e9);
 
+            for (int size = 2; size < 999; size += 7)
             {
-                TestRadixSorter<T, 4> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+                std::vector<double> data(size);
+                for (auto& d : data)
+                    d = distribution(engine);
+                std::vector<float> fdata(data.begin(), data.end());
 
-            {
-                TestRadixSorter<T, 5> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+                {
+                    TestRadixSorter<double, 16> test_sort;
+                    test_sort.chatGpt = chatGpt;
+                    test_sort.inPlace = inPlace;
+                    test_sort.parallel = parallel;
+                    test_sort(reverse, data.begin(), data.end());
+                }
 
-            {
-                TestRadixSorter<T, 10> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+                {
+                    TestRadixSorter<double, 256> test_sort;
+                    test_sort.chatGpt = chatGpt;
+                    test_sort.inPlace = inPlace;
+                    test_sort.parallel = parallel;
+                    test_sort(reverse, data.begin(), data.end());
+                }
 
-            {
-                TestRadixSorter<T, 16> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+                {
+                    TestRadixSorter<float, 10> test_sort;
+                    test_sort.chatGpt = chatGpt;
+                    test_sort.inPlace = inPlace;
+                    test_sort.parallel = parallel;
+                    test_sort(reverse, fdata.begin(), fdata.end());
+                }
 
-            {
-                TestRadixSorter<T, 20> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
+                {
+                    TestRadixSorter<float, 256> test_sort;
+                    test_sort.chatGpt = chatGpt;
+                    test_sort.inPlace = inPlace;
+                    test_sort.parallel = parallel;
+                    test_sort(reverse, fdata.begin(), fdata.end());
+                }
             }
+        }
 
-            {
-                TestRadixSorter<T, 100> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
+        TestExtremeIntegers<int64_t, 10>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<int64_t, 3>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<uint64_t, 10>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<uint64_t, 7>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<uint64_t, 256>(reverse, chatGpt, inPlace, parallel);
+#if __SIZEOF_INT128__
+        TestExtremeIntegers<__int128, 10>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<__int128, 256>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<unsigned __int128, 10>(reverse, chatGpt, inPlace, parallel);
+        TestExtremeIntegers<unsigned __int128, 16>(reverse, chatGpt, inPlace, parallel);
+#endif
 
-            {
-                TestRadixSorter<T, 256> test_sort;
-                test_sort.chatGpt = chatGpt;
-                test_sort.handleNegativeNumbers = handleNegativeNumbers;
-                test_sort(reverse, data, &data[size]);
-            }
-        }
+        TestRandomIntegers<int32_t>(reverse, chatGpt, inPlace, parallel, 1);
+        TestRandomIntegers<uint32_t>(reverse, chatGpt, inPlace, parallel, 7);
+        TestRandomIntegers<int64_t>(reverse, chatGpt, inPlace, parallel, 7);
+        TestRandomIntegers<uint64_t>(reverse, chatGpt, inPlace, parallel, 7);
+#if __SIZEOF_INT128__
+        TestRandomIntegers<__int128>(reverse, chatGpt, inPlace, parallel, 13);
+        TestRandomIntegers<unsigned __int128>(reverse, chatGpt, inPlace, parallel, 13);
+#endif
     }
-    printf("\nsuccess chatgpt:%d\n", (int)chatGpt);
+
+    TestSortByKey<int32_t, 256>(chatGpt, inPlace, parallel);
+    TestSortByKey<int64_t, 10>(chatGpt, inPlace, parallel);
+    TestSortByKey<uint16_t, 4>(chatGpt, inPlace, parallel);
+    TestArgsort<int32_t, 256>(chatGpt, inPlace, parallel);
+    TestArgsort<double, 16>(chatGpt, inPlace, parallel);
+    TestProjection(chatGpt, inPlace, parallel);
+    TestNonTrivialScratch(chatGpt, inPlace, parallel);
+    TestStrings();
+    TestCallerBuffers<int32_t, 256>(chatGpt, inPlace, parallel);
+    TestCallerBuffers<uint64_t, 16>(chatGpt, inPlace, parallel);
+    TestCallerBuffers<int16_t, 10>(chatGpt, inPlace, parallel);
+    TestScratchArena(chatGpt, inPlace, parallel);
+    TestThreadPool();
+    TestExternalSorts(parallel);
+    TestFileSorts(chatGpt, inPlace, parallel);
+    TestWriteCombining<uint8_t, 4>(chatGpt, inPlace, parallel);
+    TestWriteCombining<int32_t, 256>(chatGpt, inPlace, parallel);
+    TestWriteCombining<uint64_t, 16>(chatGpt, inPlace, parallel);
+    TestWriteCombining<double, 256>(chatGpt, inPlace, parallel);
+#if __SIZEOF_INT128__
+    TestWriteCombining<__int128, 256>(chatGpt, inPlace, parallel);
+#endif
+    TestSimdDispatch();
+    TestKeyStats<int32_t>();
+    TestKeyStats<uint32_t>();
+    TestKeyStats<int64_t>();
+    TestKeyStats<uint64_t>();
+    TestKeyStats<float>();
+    TestKeyStats<double>();
+    TestKeyStats<int16_t>();
+    TestRangeCompression<int64_t, 256>(chatGpt, inPlace, parallel);
+    TestRangeCompression<int64_t, 10>(chatGpt, inPlace, parallel);
+    TestRangeCompression<uint64_t, 16>(chatGpt, inPlace, parallel);
+    TestHistograms<uint32_t, 256>();
+    TestHistograms<int32_t, 16>();
+    TestHistograms<int64_t, 256>();
+    TestHistograms<float, 256>();
+    TestHistograms<double, 256>();
+    TestHistograms<uint16_t, 256>();
+    printf("\nsuccess chatgpt:%d inplace:%d parallel:%d\n", (int)chatGpt, (int)inPlace, (int)parallel);
 }
@@ -0,0 +1,265 @@
+//
+// radix_sort_arena.h
+//
+// Scratch memory for the sorts, reused across calls.
+//
+// Every sort needs temporaries as large as its input. Allocating them with
+// std::vector costs an allocation, and zeroing, per call, which for medium
+// arrays sorted often is a large part of the time. An arena keeps its memory
+// between sorts, and hands it out without initializing it.
+//
+// Allocations are within a Scope. When the outermost Scope ends, everything
+// allocated in it is free again, and if it took more than one block,
+// the blocks are replaced by one as large as all of them, so the next
+// sort of the same size allocates nothing. Capacity over trimThreshold
+// is then released, so one huge sort does not pin its memory forever.
+//
+// Large blocks, on Linux, are mapped directly and advised to use huge pages,
+// which cuts page faults and TLB misses by 512x for the scatter's random writes.
+// They can also be pre-faulted in parallel, so each page is first touched, and
+// so placed, by a thread of the pool, instead of all faulting serially
+// in the first pass of the sort.
+//
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+#if __linux__
+#include <sys/mman.h>
+#endif
+#include "radix_sort_thread_pool.h"
+
+class ScratchArena
+{
+public:
+    // Memory over this many bytes is freed when the outermost Scope ends.
+    // 0 frees everything, i.e. no reuse across sorts.
+    size_t trimThreshold = size_t(1) << 28;
+
+    // Blocks of at least HugePageSize bytes use huge pages, where supported.
+    bool hugePages = true;
+
+    // Touch every page of new blocks, in parallel on ThreadPool::instance().
+    bool prefault = false;
+
+    ScratchArena() = default;
+    ScratchArena(ScratchArena const &) = delete;
+    ScratchArena& operator=(ScratchArena const &) = delete;
+
+    // An arena per thread, for sorts that do not bring their own.
+    static ScratchArena& thread_default()
+    {
+        thread_local ScratchArena arena;
+        return arena;
+    }
+
+    // Allocations made during a Scope are freed when it ends.
+    class Scope
+    {
+    public:
+        explicit Scope(ScratchArena& arena)
+            : arena(arena), block(arena.current), used(arena.used)
+        {
+            arena.depth += 1;
+        }
+
+        ~Scope()
+        {
+            arena.current = block;
+            arena.used = used;
+            if (--arena.depth == 0)
+                arena.release();
+        }
+
+        Scope(Scope const &) = delete;
+        Scope& operator=(Scope const &) = delete;
+
+    private:
+        ScratchArena& arena;
+        size_t block;
+        size_t used;
+    };
+
+    // count uninitialized elements, aligned to a cache line.
+    // Only for types that can be copied into without being constructed.
+    template <typename U>
+    U* allocate(size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<U>, "scratch memory is not constructed");
+        assert(depth > 0);
+        return static_cast<U*>(allocate_bytes(count * sizeof(U)));
+    }
+
+    // Bytes held, used or not.
+    size_t capacity() const
+    {
+        size_t total{};
+        for (auto const& block : blocks)
+            total += block.size;
+        return total;
+    }
+
+    // Free all memory. There must be no Scope.
+    void trim()
+    {
+        assert(depth == 0);
+        blocks.clear();
+        current = 0;
+        used = 0;
+    }
+
+    static constexpr size_t HugePageSize = size_t(2) << 20;
+
+private:
+    static constexpr size_t Alignment = 64;
+
+    // Frees a block, however it was allocated.
+    struct Free
+    {
+        size_t mapped = 0;
+
+        void operator()(unsigned char* p) const
+        {
+#if __linux__
+            if (mapped)
+            {
+                munmap(p, mapped);
+                return;
+            }
+#endif
+            ::operator delete(p, std::align_val_t(Alignment));
+        }
+    };
+
+    struct Block
+    {
+        std::unique_ptr<unsigned char, Free> memory;
+        size_t size;
+    };
+
+    // Blocks before current are full, for the current Scope.
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+    size_t depth = 0;
+
+    Block new_block(size_t size) const
+    {
+        Block block{std::unique_ptr<unsigned char, Free>(nullptr, Free()), size};
+
+#if __linux__
+        if (hugePages && size >= HugePageSize)
+        {
+            // Round up to whole huge pages. mmap memory is zero, but
+            // that is the kernel's, on first touch, not a pass of ours.
+            size_t const mapped = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+            void* const p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED)
+            {
+                madvise(p, mapped, MADV_HUGEPAGE);
+                block.memory = std::unique_ptr<unsigned char, Free>(static_cast<unsigned char*>(p), Free{mapped});
+                block.size = mapped;
+            }
+        }
+#endif
+        if (!block.memory)
+            block.memory.reset(static_cast<unsigned char*>(::operator new(size, std::align_val_t(Alignment))));
+
+        if (prefault)
+            touch(block.memory.get(), size);
+
+        return block;
+    }
+
+    // Write one byte per page, in chunks, one per thread.
+    static void touch(unsigned char* memory, size_t size)
+    {
+        size_t const page = 4096;
+        auto& pool = ThreadPool::instance();
+        size_t const chunks = std::max<size_t>(1, std::min(pool.concurrency(), size / HugePageSize));
+        pool.parallel_for(chunks, [=](size_t chunk)
+        {
+            size_t const first = size * chunk / chunks;
+            size_t const last = size * (chunk + 1) / chunks;
+            for (size_t i = first; i < last; i += page)
+                memory[i] = 0;
+        });
+    }
+
+    void* allocate_bytes(size_t size)
+    {
+        size = (size + Alignment - 1) & ~(Alignment - 1);
+
+        // Use the current block, else a later one left from an earlier sort,
+        // else a new one, at least double the last, so growth is geometric.
+        while (current < blocks.size())
+        {
+            if (blocks[current].size - used >= size)
+            {
+                void* const p = blocks[current].memory.get() + used;
+                used += size;
+                return p;
+            }
+            current += 1;
+            used = 0;
+        }
+
+        blocks.push_back(new_block(std::max(size, blocks.empty() ? size : blocks.back().size * 2)));
+        used = size;
+        return blocks.back().memory.get();
+    }
+
+    // The outermost Scope ended. Coalesce, then trim.
+    void release()
+    {
+        size_t const total = capacity();
+        if (total > trimThreshold)
+        {
+            trim();
+            return;
+        }
+        if (blocks.size() > 1)
+        {
+            blocks.clear();
+            blocks.push_back(new_block(total));
+        }
+    }
+};
+
+// Scratch for count elements of U, for as long as the enclosing Scope.
+// Trivially copyable types come from the arena, uninitialized. Other types,
+// such as std::string, must be constructed before they are assigned to,
+// so they get a std::vector, freed with this object.
+template <typename U>
+class ScratchBuffer
+{
+public:
+    ScratchBuffer(ScratchArena& arena, size_t count)
+    {
+        if (!count)
+            return;
+        if constexpr (std::is_trivially_copyable_v<U>)
+            pointer = arena.allocate<U>(count);
+        else
+        {
+            storage.resize(count);
+            pointer = storage.data();
+        }
+    }
+
+    // Moving a vector keeps its elements where they are, so pointer stays valid.
+    ScratchBuffer(ScratchBuffer&&) = default;
+    ScratchBuffer(ScratchBuffer const &) = delete;
+    ScratchBuffer& operator=(ScratchBuffer const &) = delete;
+
+    U* data() const { return pointer; }
+
+private:
+    std::vector<U> storage;
+    U* pointer{};
+};
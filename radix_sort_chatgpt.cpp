@@ -18,67 +18,297 @@
 // To test this code, see radix_sort.cpp and pass chatgpt on command line.
 //
 #include <array>
+#include <iterator>
 #include <ctype.h>
 #include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <vector>
 #include <time.h>
+#include "radix_sort_common.h"
+#include "radix_sort_histogram.h"
+#include "radix_sort_stats.h"
+#include "radix_sort_thread_pool.h"
 
+// For power of two Base, power is a bit shift, not Base raised to a power.
+// This avoids a 64bit divide and mod per element per pass.
 template <uint64_t Base, typename T1, typename T2>
 static size_t get_digit(T1 value, T2 power)
 {
-    return (value / power) % Base;
+    if constexpr (is_power_of_two<Base>)
+        return static_cast<size_t>((value >> power) & (Base - 1));
+    else
+        return static_cast<size_t>((value / power) % Base);
 }
 
-template <size_t Base, typename Iterator, typename T>
+template <size_t Base>
+using digit_counts = std::array<size_t, Base>;
+
+// The exps (or shifts) of each digit of a key, least significant first.
+// Fixed size, for the most digits a K can have, so it is not allocated.
+template <size_t Base, typename K>
+struct digit_powers
+{
+    static constexpr size_t max_digits = []
+    {
+        K max = static_cast<K>(~K(0));
+        size_t digits = 1;
+        while (max /= Base)
+            ++digits;
+        return digits;
+    }();
+
+    std::array<K, max_digits> powers{};
+    size_t count{};
+
+    void push_back(K power) { assert(count < max_digits); powers[count++] = power; }
+    K const * data() const { return powers.data(); }
+    size_t size() const { return count; }
+    bool empty() const { return !count; }
+    K operator[](size_t i) const { return powers[i]; }
+    K const * begin() const { return data(); }
+    K const * end() const { return data() + count; }
+};
+
+// counts are this digit's counts from count_digits, consumed here.
+// Elements are read from in and written to out, which must not overlap.
+// Payloads, if any, move from values_in to values_out with their keys.
+template <size_t Base, typename T, typename P, typename Power, typename Key>
 static void
-counting_sort(Iterator begin, Iterator end, size_t size, uint64_t exp, T const & /* deduction helper */)
+counting_sort(T const * in, T* out, P values_in, P values_out, size_t size, Power exp, digit_counts<Base> & counts, Key key,
+    ScatterOptions const & options)
 {
-    using array = std::array<size_t, Base>;
-    array counts{};
-    size_t i{};
+    // Change counts to starting positions.
+    // ChatGPT went backwards from ending positions, which is as stable,
+    // but scatter goes forwards, to write combine.
+    size_t position{};
+    for (auto& count : counts)
+    {
+        auto const start = position;
+        position += count;
+        count = start;
+    }
+
+    scatter(in, values_in, size, out, values_out, counts,
+        [&](T const & value) { return get_digit<Base>(key(value), exp); }, options);
+}
 
-    // Count them, by digit.
-    for (auto it{begin}; it != end; ++it)
-        counts[get_digit<Base>(*it, exp)] += 1;
+// The exp (or shift) of each digit of max, least significant first.
+// max is an unsigned key. The exps are of the same type, so they
+// do not overflow for the full range of 64 and 128 bit keys.
+template <size_t Base, typename K>
+static digit_powers<Base, K>
+get_powers(K max)
+{
+    digit_powers<Base, K> powers;
 
-    std::vector<T> temp(size);
+    if (!(max > 0))
+        return powers;
 
-    // Change counts to ending positions.
-    for (i = 1; i < Base; ++i)
-        counts[i] += counts[i - 1];
+    if constexpr (is_power_of_two<Base>)
+    {
+        // Count the digits up front with leading zero count,
+        // instead of dividing max by exp every iteration.
+        unsigned const digits = get_digits_pow2<Base>(max);
+        K shift = 0;
 
-    // Place elements in array, going backwards,
-    // because we have ending positions.
-    for (i = 0; i < size; ++i)
+        for (unsigned i = 0; i < digits; ++i)
+        {
+            powers.push_back(shift);
+            shift += log2_base<Base>;
+        }
+    }
+    else
     {
-        auto & data = *--end;
-        temp[counts[get_digit<Base>(data, exp)] -= 1] = data;
+        // Divide max down, instead of multiplying exp up past max,
+        // which could overflow.
+        K exp = 1;
+
+        while (true)
+        {
+            powers.push_back(exp);
+            max /= Base;
+            if (!max)
+                break;
+            exp *= Base;
+        }
     }
 
-    std::copy(temp.begin(), temp.end(), begin);
+    return powers;
 }
 
-template <size_t Base, typename Iterator>
+// If skipped_passes is not null, it is incremented for each digit
+// that is the same in every element, and so needs no pass.
+// values are arrays permuted along with the keys, see Payloads.
+// Elements are sorted by projection(element), e.g. a member, see ProjectedKey.
+// scratch, if not null, is size elements used instead of allocating a temporary.
+// Other temporaries come from arena, if not null, else are allocated per call.
+// The iterators must be contiguous, e.g. pointers or of std::vector.
+template <size_t Base, typename Iterator, typename Projection = Identity, typename... V>
 static void
-radix_sort(Iterator begin, Iterator end)
+radix_sort(Iterator begin, Iterator end, size_t* skipped_passes = nullptr, Payloads<V...> values = {}, Projection projection = {},
+    typename std::iterator_traits<Iterator>::value_type* scratch = nullptr, ScratchArena* arena = nullptr,
+    ScatterOptions const & scatter_options = {})
 {
     if (begin == end)
         return;
 
-    size_t size{};
-    auto max = std::accumulate(begin, end, *begin, [&](auto a, auto b) { ++size; return std::max(a,b);});
-    assert(size == (end - begin));
-
+    size_t const size = end - begin;
     if (size < 2)
         return;
 
-    uint64_t exp = 1;
+    // Only the digits of max - min are sorted, see rebase_key.
+    using T = typename std::iterator_traits<Iterator>::value_type;
+    auto const key_stats = get_key_stats<T>(&*begin, size, nullptr, projection);
+    auto const [key, max] = rebase_key(key_stats.first, key_stats.second);
+    auto const powers = get_powers<Base>(max);
+    if (powers.empty())
+        return;
+
+    ScratchArena local_arena;
+    ScratchArena& scratch_arena = arena ? *arena : local_arena;
+    ScratchArena::Scope scope(scratch_arena);
+
+    // All the histograms are built in one read of the data,
+    // so each pass after is only a scatter.
+    // Digits are of the unsigned key of each value, not the value itself.
+    // See RadixKey, get_key_stats and rebase_key.
+    digit_counts<Base>* const counts = scratch_arena.allocate<digit_counts<Base>>(powers.size());
+    std::fill(counts, counts + powers.size(), digit_counts<Base>{});
+    count_digits_into<Base>(&*begin, size, key, powers.data(), powers.size(), counts);
+
+    // One temporary for the whole sort. It and the input swap roles
+    // every pass, like RadixSorter::helper, instead of copying back each pass.
+    ScratchBuffer<T> const buffer(scratch_arena, scratch ? 0 : size);
+    T* const temp = scratch ? scratch : buffer.data();
+    typename Payloads<V...>::Scratch const values_buffer(scratch_arena, size);
+    auto const values_temp = values_buffer.arrays();
+    size_t passes{};
+
+    for (size_t d = 0; d < powers.size(); ++d)
+    {
+        // A digit that is the same for all elements, e.g. the high digits
+        // of timestamps, would only copy the data. Skip it.
+        if (std::find(counts[d].begin(), counts[d].end(), size) != counts[d].end())
+        {
+            if (skipped_passes)
+                *skipped_passes += 1;
+            continue;
+        }
+
+        if (passes & 1)
+            counting_sort<Base>(temp, &*begin, values_temp, values, size, powers[d], counts[d], key, scatter_options);
+        else
+            counting_sort<Base>(&*begin, temp, values, values_temp, size, powers[d], counts[d], key, scatter_options);
+        ++passes;
+    }
+
+    // Odd number of passes leaves the result in temp.
+    if (passes & 1)
+    {
+        std::copy(temp, temp + size, begin);
+        values_temp.copy(values, size);
+    }
+}
+
+// Like radix_sort, but each pass is split into chunks, one per thread.
+// Each thread counts its own contiguous chunk into its own histogram.
+// The prefix sum across digits, and across chunks within a digit, gives every
+// chunk its own output positions for every digit. The threads then scatter
+// at the same time, without atomics, and the sort stays stable.
+// Inputs smaller than two chunks of min_chunk are sorted serially.
+template <size_t Base, typename Iterator, typename Projection = Identity, typename... V>
+static void
+parallel_radix_sort(Iterator begin, Iterator end, size_t* skipped_passes = nullptr, size_t min_chunk = 1 << 16, Payloads<V...> values = {}, Projection projection = {},
+    typename std::iterator_traits<Iterator>::value_type* scratch = nullptr, ScratchArena* arena = nullptr,
+    ScatterOptions const & scatter_options = {})
+{
+    if (begin == end)
+        return;
+
+    auto& pool = ThreadPool::instance();
+    size_t const size = end - begin;
+    size_t const chunks = std::min(pool.concurrency(), size / std::max<size_t>(min_chunk, 1));
+
+    if (chunks < 2)
+    {
+        radix_sort<Base>(begin, end, skipped_passes, values, projection, scratch, arena, scatter_options);
+        return;
+    }
+
+    using T = typename std::iterator_traits<Iterator>::value_type;
+    auto const key_stats = get_key_stats<T>(&*begin, size, nullptr, projection);
+    auto const [key, max] = rebase_key(key_stats.first, key_stats.second);
+    auto const powers = get_powers<Base>(max);
+
+    ScratchArena local_arena;
+    ScratchArena& scratch_arena = arena ? *arena : local_arena;
+    ScratchArena::Scope scope(scratch_arena);
+    ScratchBuffer<T> const buffer(scratch_arena, scratch ? 0 : size);
+    T* const temp = scratch ? scratch : buffer.data();
+    digit_counts<Base>* const chunk_counts = scratch_arena.allocate<digit_counts<Base>>(chunks);
+    auto chunk_begin = [=](size_t chunk) { return size * chunk / chunks; };
+    T* in = &*begin;
+    T* out = temp;
+    auto values_in = values;
+    typename Payloads<V...>::Scratch const values_buffer(scratch_arena, size);
+    auto values_out = values_buffer.arrays();
+    size_t passes{};
+
+    for (auto const exp : powers)
+    {
+        pool.parallel_for(chunks, [&](size_t chunk)
+        {
+            size_t const first = chunk_begin(chunk);
+            chunk_counts[chunk] = digit_counts<Base>{};
+            count_digits_into<Base>(in + first, chunk_begin(chunk + 1) - first, key, &exp, 1, &chunk_counts[chunk]);
+        });
+
+        // Change counts to starting positions, by digit, then by chunk.
+        // If one digit has every element, skip the pass.
+        size_t position{};
+        bool skip{};
+
+        for (size_t i = 0; i < Base && !skip; ++i)
+        {
+            size_t const start = position;
+            for (size_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                auto const count = chunk_counts[chunk][i];
+                chunk_counts[chunk][i] = position;
+                position += count;
+            }
+            skip = (position - start) == size;
+        }
+
+        if (skip)
+        {
+            if (skipped_passes)
+                *skipped_passes += 1;
+            continue;
+        }
+
+        pool.parallel_for(chunks, [&](size_t chunk)
+        {
+            size_t const first = chunk_begin(chunk);
+            scatter(in + first, values_in + first, chunk_begin(chunk + 1) - first, out, values_out, chunk_counts[chunk],
+                [&](T const & value) { return get_digit<Base>(key(value), exp); }, scatter_options);
+        });
+
+        std::swap(in, out);
+        std::swap(values_in, values_out);
+        ++passes;
+    }
 
-    while ((max / exp) > 0)
+    // Odd number of passes leaves the result in temp.
+    if (passes & 1)
     {
-        counting_sort<Base>(begin, end, size, exp, *begin);
-        exp *= Base;
+        pool.parallel_for(chunks, [&](size_t chunk)
+        {
+            size_t const first = chunk_begin(chunk);
+            size_t const count = chunk_begin(chunk + 1) - first;
+            std::copy(temp + first, temp + first + count, begin + first);
+            (values_in + first).copy(values + first, count);
+        });
     }
 }
@@ -0,0 +1,444 @@
+//
+// radix_sort_common.h
+//
+// Small helpers shared by radix_sort.cpp and radix_sort_chatgpt.cpp.
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iterator>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define RADIX_SORT_SSE2 1
+#endif
+#if __linux__
+#include <unistd.h>
+#endif
+#include "radix_sort_arena.h"
+
+// Base is a power of two, such as 2, 16, or 256.
+// Digits can then be extracted with shift and mask instead of divide and mod,
+// and a "power" of the base is represented as a bit shift.
+template <uint64_t Base>
+constexpr bool is_power_of_two = Base && !(Base & (Base - 1));
+
+// log2(Base) for power of two Base, i.e. bits per digit.
+template <uint64_t Base>
+constexpr unsigned log2_base = (Base <= 1) ? 0 : 1 + log2_base<Base / 2>;
+
+// Unsigned and signed-ness of T, like std::make_unsigned and std::is_signed,
+// but also for __int128, which the standard library only knows in GNU modes.
+template <typename T>
+struct radix_traits
+{
+    using unsigned_type = std::make_unsigned_t<T>;
+    static constexpr bool is_signed = std::is_signed_v<T>;
+};
+
+#if __SIZEOF_INT128__
+template <>
+struct radix_traits<__int128>
+{
+    using unsigned_type = unsigned __int128;
+    static constexpr bool is_signed = true;
+};
+
+template <>
+struct radix_traits<unsigned __int128>
+{
+    using unsigned_type = unsigned __int128;
+    static constexpr bool is_signed = false;
+};
+#endif
+
+// Number of bits needed to represent value, 0 for 0.
+// Like C++20 std::bit_width.
+inline unsigned bit_width64(uint64_t value)
+{
+    if (!value)
+        return 0;
+#if _MSC_VER
+    unsigned long index{};
+    _BitScanReverse64(&index, value);
+    return index + 1;
+#else
+    return 64 - __builtin_clzll(value);
+#endif
+}
+
+// bit_width64 for any unsigned type, including unsigned __int128.
+template <typename U>
+unsigned bit_width(U value)
+{
+    if constexpr (sizeof(U) > sizeof(uint64_t))
+    {
+        uint64_t const high = static_cast<uint64_t>(value >> 64);
+        return high ? 64 + bit_width64(high) : bit_width64(static_cast<uint64_t>(value));
+    }
+    else
+    {
+        return bit_width64(value);
+    }
+}
+
+// Number of Base digits needed to represent value, for power of two Base.
+// 0 has one digit, like in radix_sort.cpp's get_digits.
+template <uint64_t Base, typename U>
+unsigned get_digits_pow2(U value)
+{
+    static_assert(is_power_of_two<Base> && Base >= 2);
+    constexpr unsigned bits = log2_base<Base>;
+    unsigned const digits = (bit_width(value) + bits - 1) / bits;
+    return digits ? digits : 1;
+}
+
+// Radix sort orders unsigned integers, digit by digit. Other types
+// are sorted by mapping each value to an unsigned "key" that orders the same.
+// RadixKey<T> is the key type for T.
+//
+// For signed integers, flipping the sign bit maps the most negative value
+// to key 0, -1 to just below the middle, 0 to the middle, and the
+// most positive value to the largest key. Negative numbers then cost
+// the same as positive, one xor. The flip is only done if there are negative
+// numbers, so that small positive values still have few digits.
+template <typename T>
+struct SignFlipKey
+{
+    using type = typename radix_traits<T>::unsigned_type;
+
+    type mask{};
+
+    SignFlipKey(bool negatives = false)
+        : mask((radix_traits<T>::is_signed && negatives) ? type(type(1) << (sizeof(T) * CHAR_BIT - 1)) : type(0))
+    {
+    }
+
+    type operator()(T value) const
+    {
+        return static_cast<type>(static_cast<type>(value) ^ mask);
+    }
+};
+
+// For IEEE-754 float and double, the bits of a positive number order
+// like the number, as unsigned integers. Negative numbers order backwards.
+// So flip all the bits of negative numbers, which also moves them below
+// the positives, and flip just the sign bit of positive numbers.
+//
+// This orders -0.0 just before +0.0, i.e. -0.0 < +0.0, and NaNs by their
+// sign: negative NaNs before -infinity, positive NaNs after +infinity.
+// The usual NaN, from 0.0/0.0 or std::numeric_limits::quiet_NaN, is positive,
+// so it sorts last.
+template <typename T>
+struct FloatKey
+{
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8);
+    using type = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+
+    // negatives is ignored. Positive floats
+    // have large keys anyway, from the exponent, and NaN makes min unreliable.
+    FloatKey(bool /* negatives */ = false)
+    {
+    }
+
+    type operator()(T value) const
+    {
+        type bits;
+        memcpy(&bits, &value, sizeof(bits));
+        constexpr unsigned sign_shift = sizeof(type) * CHAR_BIT - 1;
+        type const mask = static_cast<type>(0 - (bits >> sign_shift)) | (type(1) << sign_shift);
+        return bits ^ mask;
+    }
+};
+
+template <typename T>
+using RadixKey = std::conditional_t<std::is_floating_point_v<T>, FloatKey<T>, SignFlipKey<T>>;
+
+// A projection picks what to sort by out of each element, e.g. a member
+// pointer like &Order::timestamp, or a lambda. Identity sorts by the element itself.
+// Like C++20 std::identity.
+struct Identity
+{
+    template <typename T>
+    T const & operator()(T const & value) const
+    {
+        return value;
+    }
+};
+
+// The type a projection returns for T, e.g. the type of a member.
+template <typename T, typename Projection>
+using projected_t = std::decay_t<std::invoke_result_t<Projection const &, T const &>>;
+
+// The key of the projection of T, i.e. RadixKey of the member being sorted by.
+// The projection is a type, not a std::function, so it inlines, and each
+// loop extracts a key once per element, as a load of the member.
+template <typename T, typename Projection = Identity>
+struct ProjectedKey : RadixKey<projected_t<T, Projection>>
+{
+    using Key = RadixKey<projected_t<T, Projection>>;
+    using type = typename Key::type;
+
+    Projection projection;
+
+    // Subtracted from every key, i.e. the smallest key of the data being sorted,
+    // so keys start at 0, and only the digits of the spread, max - min, are sorted,
+    // e.g. 2 bytes of timestamps within a day, instead of all 8.
+    type offset{};
+
+    ProjectedKey(Key key = Key(), Projection projection = Projection())
+        : Key(key), projection(projection)
+    {
+    }
+
+    type operator()(T const & value) const
+    {
+        return static_cast<type>(Key::operator()(std::invoke(projection, value)) - offset);
+    }
+};
+
+// Arrays of values that move along with the keys, such as row ids
+// or other columns, one array per column. Only the keys are read to build
+// histograms, so the counting passes stay dense, and the values are moved
+// in the same loops that move the keys. Payloads<> is empty, for sorting
+// just keys, and then costs nothing.
+template <typename... V>
+struct Payloads
+{
+    static constexpr bool empty = sizeof...(V) == 0;
+
+    std::tuple<V*...> arrays;
+
+    // The arrays, each advanced by offset elements.
+    Payloads operator+(size_t offset) const
+    {
+        return std::apply([=](V*... a) { return Payloads{{(a + offset)...}}; }, arrays);
+    }
+
+    // this[to] = from[index], for each array.
+    void move(size_t to, Payloads const & from, size_t index) const
+    {
+        move(to, from, index, std::index_sequence_for<V...>{});
+    }
+
+    // Copy elements [0, size) of each array to the same place in to.
+    void copy(Payloads const & to, size_t size) const
+    {
+        copy(to, size, std::index_sequence_for<V...>{});
+    }
+
+    std::tuple<V...> get(size_t index) const
+    {
+        return std::apply([=](V*... a) { return std::tuple<V...>(a[index]...); }, arrays);
+    }
+
+    void set(size_t index, std::tuple<V...> const & values) const
+    {
+        set(index, values, std::index_sequence_for<V...>{});
+    }
+
+    // Temporary storage for size elements of each array, as ScratchBuffer,
+    // so from the arena when the column type allows. It must outlive arrays().
+    class Scratch
+    {
+    public:
+        // Unused for Payloads<>, as are the parameters below.
+        Scratch([[maybe_unused]] ScratchArena& arena, [[maybe_unused]] size_t size)
+            : buffers(ScratchBuffer<V>(arena, size)...)
+        {
+        }
+
+        Payloads arrays() const
+        {
+            return std::apply([](auto const &... buffer) { return Payloads{{buffer.data()...}}; }, buffers);
+        }
+
+    private:
+        std::tuple<ScratchBuffer<V>...> buffers;
+    };
+
+private:
+    template <size_t... I>
+    void move([[maybe_unused]] size_t to, [[maybe_unused]] Payloads const & from, [[maybe_unused]] size_t index, std::index_sequence<I...>) const
+    {
+        ((std::get<I>(arrays)[to] = std::get<I>(from.arrays)[index]), ...);
+    }
+
+    template <size_t... I>
+    void copy([[maybe_unused]] Payloads const & to, [[maybe_unused]] size_t size, std::index_sequence<I...>) const
+    {
+        (std::copy(std::get<I>(arrays), std::get<I>(arrays) + size, std::get<I>(to.arrays)), ...);
+    }
+
+    template <size_t... I>
+    void set([[maybe_unused]] size_t index, [[maybe_unused]] std::tuple<V...> const & values, std::index_sequence<I...>) const
+    {
+        ((std::get<I>(arrays)[index] = std::get<I>(values)), ...);
+    }
+};
+
+// to[i] = from[permutation[i]], for each array, for i in [0, size).
+// This applies a permutation from argsort to any number of columns.
+//
+// The reads of from are random. Going one column at a time would read
+// the permutation once per column, and going one row at a time would touch
+// every column's cache lines at once. Instead, go a block of the permutation at a
+// time, small enough to stay in L1, through every column.
+template <size_t Block = 1024, typename Index, typename... V>
+void gather(Index const * permutation, size_t size, Payloads<V...> from, Payloads<V...> to)
+{
+    for (size_t first = 0; first < size; first += Block)
+    {
+        size_t const last = std::min(size, first + Block);
+        std::apply([=](V*... out)
+        {
+            std::apply([=](V*... in)
+            {
+                auto column = [=](auto* out, auto* in)
+                {
+                    for (size_t i = first; i < last; ++i)
+                        out[i] = in[permutation[i]];
+                };
+                (column(out, in), ...);
+            }, from.arrays);
+        }, to.arrays);
+    }
+}
+
+// Bytes of the last level cache, or a guess.
+inline size_t last_level_cache_size()
+{
+    static size_t const size = []
+    {
+#if __linux__ && defined(_SC_LEVEL3_CACHE_SIZE)
+        long const l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (l3 > 0)
+            return static_cast<size_t>(l3);
+        long const l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (l2 > 0)
+            return static_cast<size_t>(l2);
+#endif
+        return size_t(32) << 20;
+    }();
+    return size;
+}
+
+// How scatter writes.
+struct ScatterOptions
+{
+    // Scatters of at least this many elements are write combined, see scatter.
+    // SIZE_MAX disables it.
+    size_t writeCombiningThreshold = size_t(1) << 16;
+
+    // Write combined scatters of at least this many bytes write whole
+    // lines with non-temporal stores, which do not read the line first, and do not
+    // evict what is in cache for data that will not be read again soon.
+    // This is for the LSD sort, whose passes each write more than fits in cache.
+    size_t streamingBytes = last_level_cache_size();
+
+    // streamingBytes for the MSD sort, i.e. RadixSorter::helper. Each bucket
+    // it writes is read right back by the recursion, but a scatter larger than
+    // the cache evicts the start of its output before the end is written, so
+    // streaming wins there too, by about 10% in BenchmarkScatter.
+    // SIZE_MAX disables it.
+    size_t msdStreamingBytes = last_level_cache_size();
+};
+
+// Write a 64 byte line from an aligned buffer to aligned to, bypassing cache.
+inline void stream_line(void* to, void const * from)
+{
+#if RADIX_SORT_SSE2
+    auto const source = static_cast<__m128i const *>(from);
+    auto const destination = static_cast<__m128i*>(to);
+    _mm_stream_si128(destination + 0, _mm_load_si128(source + 0));
+    _mm_stream_si128(destination + 1, _mm_load_si128(source + 1));
+    _mm_stream_si128(destination + 2, _mm_load_si128(source + 2));
+    _mm_stream_si128(destination + 3, _mm_load_si128(source + 3));
+#else
+    memcpy(to, from, 64);
+#endif
+}
+
+// scatter's staging, a line for each of up to 256 buckets. It is not in
+// scatter, so that all its instantiations share one buffer per thread.
+inline unsigned char* scatter_staging()
+{
+    alignas(64) static thread_local unsigned char staging[256 * 64];
+    return staging;
+}
+
+// Move in[i] to out[positions[digit(in[i])]++], for i in [0, size),
+// and values along with them. That is the scatter of every radix sort pass.
+//
+// With Base destinations, e.g. 256, the plain loop writes all over, and each
+// write is to a different line, and often page, than the last, which thrashes
+// L1 and the TLB. Instead, for large scatters, each bucket has one cache line of
+// staging, and a line is written to out when it is full, i.e. when it reaches
+// a line boundary of out. For Base 256 the staging is 16KB, which stays in L1.
+// Order within a bucket is kept, so the sort stays stable.
+//
+// Write combining needs no values, elements that evenly divide a line,
+// and Base at most 256.
+template <size_t Base, typename T, typename P, typename Digit>
+void scatter(T const * in, P values_in, size_t size, T* out, P values_out,
+    std::array<size_t, Base>& positions, Digit digit, ScatterOptions const & options)
+{
+    constexpr size_t Line = 64;
+    if constexpr (P::empty && std::is_trivially_copyable_v<T> && (Line % sizeof(T)) == 0 && Base <= 256)
+    {
+        if (size >= options.writeCombiningThreshold && (reinterpret_cast<uintptr_t>(out) % sizeof(T)) == 0)
+        {
+            constexpr size_t PerLine = Line / sizeof(T);
+            unsigned char* const staging = scatter_staging();
+            std::array<unsigned char, Base> staged{};
+            bool const streaming = size * sizeof(T) >= options.streamingBytes;
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                size_t const d = digit(in[i]);
+                memcpy(&staging[d * Line + staged[d] * sizeof(T)], &in[i], sizeof(T));
+                staged[d] += 1;
+                T* const end = out + ++positions[d];
+                if ((reinterpret_cast<uintptr_t>(end) % Line) == 0)
+                {
+                    // Full line, or the first, partial, line of the bucket.
+                    if (streaming && staged[d] == PerLine)
+                        stream_line(end - PerLine, &staging[d * Line]);
+                    else
+                        memcpy(end - staged[d], &staging[d * Line], staged[d] * sizeof(T));
+                    staged[d] = 0;
+                }
+            }
+
+            for (size_t d = 0; d < Base; ++d)
+            {
+                if (staged[d])
+                    memcpy(out + positions[d] - staged[d], &staging[d * Line], staged[d] * sizeof(T));
+            }
+#if RADIX_SORT_SSE2
+            if (streaming)
+                _mm_sfence();
+#endif
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        auto const position = positions[digit(in[i])]++;
+        out[position] = in[i];
+        values_out.move(position, values_in, i);
+    }
+}
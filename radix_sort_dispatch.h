@@ -0,0 +1,115 @@
+//
+// radix_sort_dispatch.h
+//
+// Choosing SIMD kernels at runtime.
+//
+// One binary runs on old and new x86 CPUs. Each hot kernel, e.g. the
+// histogram, has a scalar version, and versions for some of SSE4.2, AVX2
+// and AVX-512, compiled with RADIX_SORT_TARGET instead of -m flags. The CPU
+// is asked once, with cpuid, which it has, and each kernel switches on
+// simd_level() to the best version it has at or below that level.
+//
+// The environment variable RADIX_SORT_SIMD, one of scalar, sse4.2, avx2 or
+// avx512, lowers the level, e.g. to compare kernels, or to test the ones
+// a fleet's older CPUs run. It cannot raise it past what the CPU has.
+//
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define RADIX_SORT_X86_DISPATCH 1
+#define RADIX_SORT_TARGET(features) __attribute__((target(features)))
+#elif defined(_MSC_VER) && defined(_M_X64) && !defined(__clang__)
+// MSVC compiles any intrinsic in any function, so needs no target.
+#include <immintrin.h>
+#include <intrin.h>
+#define RADIX_SORT_X86_DISPATCH 1
+#define RADIX_SORT_TARGET(features)
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    Sse42,
+    Avx2,
+    Avx512,
+};
+
+inline char const * simd_level_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Sse42: return "sse4.2";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Avx512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+// The level named name, as simd_level_name returns, else false.
+inline bool parse_simd_level(char const * name, SimdLevel& level)
+{
+    for (auto candidate : {SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512})
+    {
+        if (strcmp(name, simd_level_name(candidate)) == 0)
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The best level this CPU, and OS, supports. AVX state must be saved by the OS
+// on context switch, which cpuid's OSXSAVE and xgetbv report.
+inline SimdLevel cpu_simd_level()
+{
+#if RADIX_SORT_X86_DISPATCH && !defined(_MSC_VER)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SimdLevel::Sse42;
+#elif RADIX_SORT_X86_DISPATCH
+    int info[4];
+    __cpuid(info, 0);
+    int const max_leaf = info[0];
+    __cpuid(info, 1);
+    bool const sse42 = (info[2] >> 20) & 1;
+    bool const osxsave = (info[2] >> 27) & 1;
+    unsigned long long const xcr0 = osxsave ? _xgetbv(0) : 0;
+    int leaf7[4]{};
+    if (max_leaf >= 7)
+        __cpuidex(leaf7, 7, 0);
+    if ((xcr0 & 0xe6) == 0xe6 && ((leaf7[1] >> 16) & 1) && ((leaf7[1] >> 31) & 1))
+        return SimdLevel::Avx512;
+    if ((xcr0 & 6) == 6 && ((leaf7[1] >> 5) & 1))
+        return SimdLevel::Avx2;
+    if (sse42)
+        return SimdLevel::Sse42;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// The level kernels use: the CPU's, or lower, per RADIX_SORT_SIMD.
+inline SimdLevel detect_simd_level()
+{
+    SimdLevel const cpu = cpu_simd_level();
+    SimdLevel forced{};
+    char const * const name = getenv("RADIX_SORT_SIMD");
+    if (name && parse_simd_level(name, forced) && forced < cpu)
+        return forced;
+    return cpu;
+}
+
+// Detected once, on first use.
+inline SimdLevel simd_level()
+{
+    static SimdLevel const level = detect_simd_level();
+    return level;
+}
@@ -0,0 +1,305 @@
+//
+// radix_sort_external.cpp
+//
+// Out of core radix sort, for files of numbers larger than memory.
+//
+// This is the first level of RadixSorter::helper, with files for buckets.
+// The input is read once, and each element is appended to the run file
+// of its top digit, through a large buffer per bucket, so the writes are
+// large and sequential. Then each run, in order, is read back, sorted in memory
+// by RadixSorter, and appended to the output. That is two reads and two writes
+// of the data.
+//
+// The top digit is the top 8 bits of the key, for all the input. If that
+// leaves a bucket larger than memory, e.g. because all the numbers are small,
+// that bucket is sorted the same way, by the 8 bits below the highest bit
+// that differs within it. Each bucket's min and max key are kept while spilling
+// for this, so digits that are the same for the whole bucket are skipped,
+// like skippedPasses, and a bucket of equal keys is just copied.
+//
+// Memory use is about memoryLimit. Sorting in memory takes half for the data
+// and half for the sort's scratch. Spilling takes half for reading and half
+// for the bucket buffers, and the sorter's arena is emptied first, since its
+// scratch from sorting earlier buckets would otherwise be a third half.
+//
+// Files are raw arrays of T, in native byte order.
+//
+// To test this code, see radix_sort.cpp.
+//
+#include <algorithm>
+#include <array>
+#include <errno.h>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#if _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+template <typename T>
+class ExternalRadixSorter
+{
+public:
+    // Bytes of memory to use, approximately.
+    size_t memoryLimit = size_t(1) << 30;
+
+    // Where run files go. They are removed when done with.
+    std::string tempDirectory = ".";
+
+    // Sorts the buckets that fit in memory. Set e.g. parallel on it.
+    RadixSorter<T, 256> sorter;
+
+    // Statistics, for the last sort.
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    size_t runs = 0;
+
+    // Sort the file input_path to output_path, which must be different.
+    // Return false on I/O error, or out of memory, with errno set.
+    bool sort_file(const char* input_path, const char* output_path)
+    {
+        bytesRead = 0;
+        bytesWritten = 0;
+        runs = 0;
+
+        File in(fopen(input_path, "rb"));
+        if (!in)
+            return false;
+        File out(fopen(output_path, "wb"));
+        if (!out)
+            return false;
+
+        bool const ok = sort_stream(in.get(), out.get(), KeyBits - DigitBits);
+        data.reset();
+        data_capacity = 0;
+        return fclose(out.release()) == 0 && ok;
+    }
+
+private:
+    using Key = RadixKey<T>;
+    using K = typename Key::type;
+
+    static constexpr unsigned KeyBits = sizeof(K) * CHAR_BIT;
+    static constexpr unsigned DigitBits = 8;
+    static constexpr size_t Buckets = size_t(1) << DigitBits;
+
+    // The key is the same for every element, instead of chosen from min,
+    // which is not known until all is read. It orders the same.
+    Key const key{true};
+
+    struct Close
+    {
+        void operator()(FILE* file) const
+        {
+            fclose(file);
+        }
+    };
+    using File = std::unique_ptr<FILE, Close>;
+
+    struct Free
+    {
+        void operator()(T* buffer) const
+        {
+            free(buffer);
+        }
+    };
+
+    // Input, or a run read back. Only one is in use at a time.
+    // It is not initialized, and grows only as far as the input goes, see
+    // read_data, so a small file does not cost memoryLimit / 2 of zeroing.
+    std::unique_ptr<T, Free> data;
+    size_t data_capacity = 0;
+
+    // Elements that can be sorted in memory, i.e. with scratch as large.
+    size_t capacity() const
+    {
+        return std::max<size_t>(memoryLimit / 2 / sizeof(T), 1);
+    }
+
+    size_t read(FILE* file, T* buffer, size_t count)
+    {
+        size_t const n = fread(buffer, sizeof(T), count, file);
+        bytesRead += n * sizeof(T);
+        return n;
+    }
+
+    // Read up to count elements of file into data, growing data as they come,
+    // doubling, instead of to count up front. realloc, of large blocks,
+    // moves pages instead of copying them. Return false if out of memory.
+    bool read_data(FILE* file, size_t count, size_t& size)
+    {
+        size_t const MinSize = std::max<size_t>((size_t(64) << 10) / sizeof(T), 1);
+        size = 0;
+
+        while (size < count)
+        {
+            size_t const target = std::min(count, std::max({ data_capacity, size * 2, MinSize }));
+            if (target > data_capacity)
+            {
+                T* const grown = static_cast<T*>(realloc(data.get(), target * sizeof(T)));
+                if (!grown)
+                {
+                    errno = ENOMEM;
+                    return false;
+                }
+                data.release();
+                data.reset(grown);
+                data_capacity = target;
+            }
+
+            size_t const n = read(file, data.get() + size, target - size);
+            size += n;
+            if (size < target)
+                break;
+        }
+        return true;
+    }
+
+    bool write(FILE* file, T const* buffer, size_t count)
+    {
+        bytesWritten += count * sizeof(T);
+        return fwrite(buffer, sizeof(T), count, file) == count;
+    }
+
+    static bool at_end(FILE* file)
+    {
+        int const c = getc(file);
+        if (c == EOF)
+            return true;
+        ungetc(c, file);
+        return false;
+    }
+
+    std::string run_path(unsigned shift, size_t bucket) const
+    {
+#if _WIN32
+        auto const pid = _getpid();
+#else
+        auto const pid = getpid();
+#endif
+        return tempDirectory + "/radix_sort." + std::to_string(pid) + "." +
+            std::to_string(reinterpret_cast<uintptr_t>(this)) + "." +
+            std::to_string(shift) + "." + std::to_string(bucket);
+    }
+
+    // Sort all of in to out. Keys of in are the same above bit shift + DigitBits.
+    bool sort_stream(FILE* in, FILE* out, unsigned shift)
+    {
+        size_t const capacity = this->capacity();
+
+        // All of it fits, sort in memory.
+        size_t size;
+        if (!read_data(in, capacity, size))
+            return false;
+        if (size < capacity || at_end(in))
+        {
+            if (ferror(in))
+                return false;
+            sorter.sort(data.get(), size);
+            return write(out, data.get(), size);
+        }
+
+        // Spill each element to its bucket's run, through a buffer per bucket.
+        // data is now capacity elements, which the runs read back into.
+        // The buffers take the memory the in memory sort used for scratch.
+        sorter.scratch_arena().trim();
+        size_t const buffer_size = std::max<size_t>(capacity / Buckets, 1);
+        std::vector<T> buffers(buffer_size * Buckets);
+        std::array<size_t, Buckets> buffered{};
+        std::array<uint64_t, Buckets> counts{};
+        std::array<K, Buckets> mins;
+        std::array<K, Buckets> maxes{};
+        std::array<File, Buckets> files;
+        std::vector<std::string> paths(Buckets);
+        mins.fill(~K(0));
+
+        auto flush = [&](size_t bucket)
+        {
+            if (!files[bucket])
+            {
+                paths[bucket] = run_path(shift, bucket);
+                files[bucket].reset(fopen(paths[bucket].c_str(), "wb"));
+                if (!files[bucket])
+                    return false;
+                runs += 1;
+            }
+            bool const ok = write(files[bucket].get(), &buffers[bucket * buffer_size], buffered[bucket]);
+            buffered[bucket] = 0;
+            return ok;
+        };
+
+        bool ok = true;
+        while (size && ok)
+        {
+            for (size_t i = 0; i < size && ok; ++i)
+            {
+                K const k = key(data.get()[i]);
+                size_t const bucket = static_cast<size_t>((k >> shift) & (Buckets - 1));
+                counts[bucket] += 1;
+                mins[bucket] = std::min(mins[bucket], k);
+                maxes[bucket] = std::max(maxes[bucket], k);
+                buffers[bucket * buffer_size + buffered[bucket]++] = data.get()[i];
+                if (buffered[bucket] == buffer_size)
+                    ok = flush(bucket);
+            }
+            size = read(in, data.get(), capacity);
+        }
+
+        // Close the runs, so a bucket sorted out of core
+        // does not have every run of every level open at once.
+        for (size_t bucket = 0; bucket < Buckets; ++bucket)
+        {
+            if (ok && buffered[bucket])
+                ok = flush(bucket);
+            if (files[bucket] && fclose(files[bucket].release()) != 0)
+                ok = false;
+        }
+        ok = ok && !ferror(in);
+        buffers = std::vector<T>();
+
+        // Sort each run, in order, and append it to out.
+        for (size_t bucket = 0; bucket < Buckets; ++bucket)
+        {
+            if (paths[bucket].empty())
+                continue;
+
+            File file(ok ? fopen(paths[bucket].c_str(), "rb") : nullptr);
+            FILE* const run = file.get();
+            ok = ok && run;
+
+            if (ok)
+            {
+                if (counts[bucket] <= capacity)
+                {
+                    size = read(run, data.get(), counts[bucket]);
+                    ok = size == counts[bucket];
+                    sorter.sort(data.get(), size);
+                    ok = ok && write(out, data.get(), size);
+                }
+                else if (mins[bucket] == maxes[bucket])
+                {
+                    // All equal, so already sorted.
+                    while (ok && (size = read(run, data.get(), capacity)) != 0)
+                        ok = write(out, data.get(), size);
+                    ok = ok && !ferror(run);
+                }
+                else
+                {
+                    // Too large. Sort it the same way, by the highest 8 bits that differ.
+                    unsigned const bits = bit_width(static_cast<K>(mins[bucket] ^ maxes[bucket]));
+                    ok = sort_stream(run, out, (bits > DigitBits) ? (bits - DigitBits) : 0);
+                }
+            }
+
+            file.reset();
+            remove(paths[bucket].c_str());
+        }
+
+        return ok;
+    }
+};
@@ -0,0 +1,210 @@
+//
+// radix_sort_file.cpp
+//
+// Sort a raw binary file of fixed width numbers in place, through mmap.
+//
+//   radix_sort sortfile data.bin int64 [little|big]
+//
+// The file is mapped shared and sorted where it is, so there is no read()
+// or write() copy, and no process in between to load it into. Scratch, as large
+// as the file, is an anonymous mapping. The default byte order is the host's.
+// A file of the other byte order is swapped in place before and after sorting.
+//
+// chatgpt, inplace and parallel on the command line apply, as for the tests.
+// inplace needs no scratch.
+//
+// To test this code, see radix_sort.cpp.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+inline bool host_is_little_endian()
+{
+    uint16_t const one = 1;
+    unsigned char first{};
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+template <typename U>
+U byte_swap(U value)
+{
+    static_assert(std::is_unsigned_v<U>);
+    if constexpr (sizeof(U) == 4)
+    {
+#if _MSC_VER
+        return _byteswap_ulong(value);
+#else
+        return __builtin_bswap32(value);
+#endif
+    }
+    else
+    {
+        static_assert(sizeof(U) == 8);
+#if _MSC_VER
+        return _byteswap_uint64(value);
+#else
+        return __builtin_bswap64(value);
+#endif
+    }
+}
+
+// Reverse the bytes of each element, e.g. of a float, through its bits.
+template <typename T>
+void byte_swap(T* data, size_t size)
+{
+    using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    for (size_t i = 0; i < size; ++i)
+    {
+        U bits;
+        memcpy(&bits, &data[i], sizeof(U));
+        bits = byte_swap(bits);
+        memcpy(&data[i], &bits, sizeof(U));
+    }
+}
+
+// Flags for sorting a file, from the command line.
+struct FileSortOptions
+{
+    bool bigEndian = !host_is_little_endian();
+    bool chatGpt = false;
+    bool inPlace = false;
+    bool parallel = false;
+};
+
+#if !_WIN32
+
+// Sort data, which is mapped, with scratch in an anonymous mapping.
+template <typename T>
+bool sort_mapped(T* data, size_t size, FileSortOptions const & options)
+{
+    bool const swap = options.bigEndian == host_is_little_endian();
+    if (swap)
+        byte_swap(data, size);
+
+    RadixSorter<T, 256> sort;
+    sort.chatGpt = options.chatGpt;
+    sort.inPlace = options.inPlace;
+    sort.parallel = options.parallel;
+
+    if (options.inPlace)
+    {
+        sort.sort(data, size);
+    }
+    else
+    {
+        size_t const bytes = size * sizeof(T);
+        void* const scratch = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (scratch == MAP_FAILED)
+        {
+            perror("mmap scratch");
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(scratch, bytes, MADV_HUGEPAGE);
+#endif
+        sort.sort(data, size, static_cast<T*>(scratch));
+        munmap(scratch, bytes);
+    }
+
+    if (swap)
+        byte_swap(data, size);
+    return true;
+}
+
+// Sort the file at path, of type, which is int32, uint32, int64, uint64, float
+// or double, in place. Print the error and return false on failure.
+inline bool sort_file_in_place(const char* path, const char* type, FileSortOptions const & options)
+{
+    size_t width{};
+    if (strcmp(type, "int32") == 0 || strcmp(type, "uint32") == 0 || strcmp(type, "float") == 0)
+        width = 4;
+    else if (strcmp(type, "int64") == 0 || strcmp(type, "uint64") == 0 || strcmp(type, "double") == 0)
+        width = 8;
+    else
+    {
+        printf("unknown type %s, expected int32, uint32, int64, uint64, float or double\n", type);
+        return false;
+    }
+
+    int const fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror(path);
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0)
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    size_t const bytes = static_cast<size_t>(st.st_size);
+    if (bytes % width)
+    {
+        printf("%s: size %zu is not a multiple of %zu\n", path, bytes, width);
+        close(fd);
+        return false;
+    }
+
+    if (bytes < 2 * width)
+    {
+        close(fd);
+        return true;
+    }
+
+    void* const map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror(path);
+        return false;
+    }
+
+    // Read it all soon, in order. The first pass of every engine is a sequential read.
+    madvise(map, bytes, MADV_WILLNEED);
+    madvise(map, bytes, MADV_SEQUENTIAL);
+
+    size_t const size = bytes / width;
+    bool ok{};
+    if (strcmp(type, "int32") == 0)
+        ok = sort_mapped(static_cast<int32_t*>(map), size, options);
+    else if (strcmp(type, "uint32") == 0)
+        ok = sort_mapped(static_cast<uint32_t*>(map), size, options);
+    else if (strcmp(type, "float") == 0)
+        ok = sort_mapped(static_cast<float*>(map), size, options);
+    else if (strcmp(type, "int64") == 0)
+        ok = sort_mapped(static_cast<int64_t*>(map), size, options);
+    else if (strcmp(type, "uint64") == 0)
+        ok = sort_mapped(static_cast<uint64_t*>(map), size, options);
+    else
+        ok = sort_mapped(static_cast<double*>(map), size, options);
+
+    if (msync(map, bytes, MS_SYNC) != 0)
+    {
+        perror(path);
+        ok = false;
+    }
+    munmap(map, bytes);
+    return ok;
+}
+
+#else
+
+inline bool sort_file_in_place(const char* path, const char* /* type */, FileSortOptions const & /* options */)
+{
+    printf("%s: sortfile is not implemented on Windows\n", path);
+    return false;
+}
+
+#endif
@@ -0,0 +1,377 @@
+//
+// radix_sort_histogram.h
+//
+// Counting digits, for the histograms of both sorts.
+//
+// The plain loop, counts[digit(data[i])] += 1, is slow when neighboring
+// elements have the same digit, as in sorted, nearly sorted, or low cardinality
+// data, and in the high digits of most data. Each increment then has to wait
+// for the store of the one before it to forward to its load.
+//
+// Instead, element i is counted in table i % lanes, so neighbors increment
+// different counters, and the tables are summed at the end. Lanes are also
+// SIMD lanes: with SSE4.2, AVX2 or AVX-512, keys and digits are computed a vector
+// at a time, and lane j of every vector counts in table j, so the lanes of one
+// vector never conflict. With AVX-512, the counts are gathered, incremented and
+// scattered back a vector at a time. The kernel is chosen at runtime,
+// see radix_sort_dispatch.h.
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+#include "radix_sort_common.h"
+#include "radix_sort_dispatch.h"
+
+
+// The digit of key k at power, which is a shift for power of two Base.
+template <size_t Base, typename K, typename Power>
+size_t digit_of(K k, Power power)
+{
+    if constexpr (is_power_of_two<Base>)
+        return static_cast<size_t>((k >> power) & (Base - 1));
+    else
+        return static_cast<size_t>((k / power) % Base);
+}
+
+// Scalar: lanes tables, element i in table i % lanes.
+// tables is lanes * digits * Base counts, table (lane, d) at (lane * digits + d) * Base.
+// Four elements at a time, so four increments are in flight, whatever lanes is.
+template <size_t Base, typename T, typename Key, typename Power>
+void count_lanes_scalar(T const * data, size_t size, Key const & key, Power const * powers, size_t digits,
+    size_t lanes, uint32_t* tables)
+{
+    size_t const stride = digits * Base;
+    size_t i{};
+    if (lanes >= 4)
+    {
+        for (; i + 4 <= size; i += 4)
+        {
+            auto const k0 = key(data[i]);
+            auto const k1 = key(data[i + 1]);
+            auto const k2 = key(data[i + 2]);
+            auto const k3 = key(data[i + 3]);
+            for (size_t d = 0; d < digits; ++d)
+            {
+                uint32_t* const table = tables + d * Base;
+                table[digit_of<Base>(k0, powers[d])] += 1;
+                table[stride + digit_of<Base>(k1, powers[d])] += 1;
+                table[2 * stride + digit_of<Base>(k2, powers[d])] += 1;
+                table[3 * stride + digit_of<Base>(k3, powers[d])] += 1;
+            }
+        }
+    }
+    for (; i < size; ++i)
+    {
+        auto const k = key(data[i]);
+        for (size_t d = 0; d < digits; ++d)
+            tables[d * Base + digit_of<Base>(k, powers[d])] += 1;
+    }
+}
+
+#if RADIX_SORT_X86_DISPATCH
+
+// The unsigned key of a vector of T, like ProjectedKey of SignFlipKey or FloatKey,
+// offset included. For 64 bit floats, there is no arithmetic shift, so compare with 0 instead.
+template <typename T, typename Key>
+RADIX_SORT_TARGET("sse4.2")
+inline __m128i key_sse42(__m128i x, Key const & key)
+{
+    __m128i k;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if constexpr (sizeof(T) == 4)
+            k = _mm_xor_si128(x, _mm_or_si128(_mm_srai_epi32(x, 31), _mm_set1_epi32(INT32_MIN)));
+        else
+            k = _mm_xor_si128(x, _mm_or_si128(_mm_cmpgt_epi64(_mm_setzero_si128(), x), _mm_set1_epi64x(INT64_MIN)));
+    }
+    else if constexpr (sizeof(T) == 4)
+    {
+        k = _mm_xor_si128(x, _mm_set1_epi32(static_cast<int32_t>(key.mask)));
+    }
+    else
+    {
+        k = _mm_xor_si128(x, _mm_set1_epi64x(static_cast<int64_t>(key.mask)));
+    }
+    if constexpr (sizeof(T) == 4)
+        return _mm_sub_epi32(k, _mm_set1_epi32(static_cast<int32_t>(key.offset)));
+    else
+        return _mm_sub_epi64(k, _mm_set1_epi64x(static_cast<int64_t>(key.offset)));
+}
+
+// Lane indices are extracted, and incremented one at a time.
+// Extracted, not stored to memory and loaded back, because a narrow load from
+// the middle of a wide store does not forward from it on every CPU, and stalls.
+// Only for 4 byte T. With 8 byte T, 2 lanes measured no faster than count_lanes_scalar's 4.
+template <size_t Base, typename T, typename Key, typename Power>
+RADIX_SORT_TARGET("sse4.2")
+void count_lanes_sse42(T const * data, size_t size, Key const & key, Power const * powers, size_t digits, uint32_t* tables)
+{
+    static_assert(sizeof(T) == 4);
+    constexpr size_t Lanes = 4;
+    auto const stride = static_cast<int>(digits * Base);
+    __m128i const mask = _mm_set1_epi32(Base - 1);
+    __m128i const lane_offsets = _mm_setr_epi32(0, stride, 2 * stride, 3 * stride);
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m128i const k = key_sse42<T>(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i)), key);
+        for (size_t d = 0; d < digits; ++d)
+        {
+            __m128i const shift = _mm_cvtsi32_si128(static_cast<int>(powers[d]));
+            __m128i const index = _mm_add_epi32(_mm_and_si128(_mm_srl_epi32(k, shift), mask), lane_offsets);
+            uint32_t* const table = tables + d * Base;
+            table[_mm_cvtsi128_si32(index)] += 1;
+            table[_mm_extract_epi32(index, 1)] += 1;
+            table[_mm_extract_epi32(index, 2)] += 1;
+            table[_mm_extract_epi32(index, 3)] += 1;
+        }
+    }
+    count_lanes_scalar<Base>(data + i, size - i, key, powers, digits, Lanes, tables);
+}
+
+// The unsigned key of a vector of T, like SignFlipKey or FloatKey.
+// For 64 bit floats, AVX2 has no arithmetic shift, so compare with 0 instead.
+template <typename T, typename Key>
+RADIX_SORT_TARGET("avx2")
+inline __m256i key_avx2(__m256i x, Key const & key)
+{
+    __m256i k;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if constexpr (sizeof(T) == 4)
+            k = _mm256_xor_si256(x, _mm256_or_si256(_mm256_srai_epi32(x, 31), _mm256_set1_epi32(INT32_MIN)));
+        else
+            k = _mm256_xor_si256(x, _mm256_or_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), x), _mm256_set1_epi64x(INT64_MIN)));
+    }
+    else if constexpr (sizeof(T) == 4)
+    {
+        k = _mm256_xor_si256(x, _mm256_set1_epi32(static_cast<int32_t>(key.mask)));
+    }
+    else
+    {
+        k = _mm256_xor_si256(x, _mm256_set1_epi64x(static_cast<int64_t>(key.mask)));
+    }
+    if constexpr (sizeof(T) == 4)
+        return _mm256_sub_epi32(k, _mm256_set1_epi32(static_cast<int32_t>(key.offset)));
+    else
+        return _mm256_sub_epi64(k, _mm256_set1_epi64x(static_cast<int64_t>(key.offset)));
+}
+
+// AVX2 has gather but no scatter, so lane indices are extracted, as for SSE4.2.
+template <size_t Base, typename T, typename Key, typename Power>
+RADIX_SORT_TARGET("avx2")
+void count_lanes_avx2(T const * data, size_t size, Key const & key, Power const * powers, size_t digits, uint32_t* tables)
+{
+    constexpr size_t Lanes = 32 / sizeof(T);
+    auto const stride = static_cast<int>(digits * Base);
+    __m256i mask;
+    __m256i lane_offsets;
+    if constexpr (sizeof(T) == 4)
+    {
+        mask = _mm256_set1_epi32(Base - 1);
+        lane_offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    }
+    else
+    {
+        mask = _mm256_set1_epi64x(Base - 1);
+        lane_offsets = _mm256_setr_epi64x(0, stride, 2 * stride, 3 * stride);
+    }
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m256i const k = key_avx2<T>(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i)), key);
+        for (size_t d = 0; d < digits; ++d)
+        {
+            __m128i const shift = _mm_cvtsi32_si128(static_cast<int>(powers[d]));
+            __m256i const digit = _mm256_and_si256((sizeof(T) == 4) ? _mm256_srl_epi32(k, shift) : _mm256_srl_epi64(k, shift), mask);
+            uint32_t* const table = tables + d * Base;
+            if constexpr (sizeof(T) == 4)
+            {
+                __m256i const index = _mm256_add_epi32(digit, lane_offsets);
+                __m128i const lo = _mm256_castsi256_si128(index);
+                __m128i const hi = _mm256_extracti128_si256(index, 1);
+                table[_mm_cvtsi128_si32(lo)] += 1;
+                table[_mm_extract_epi32(lo, 1)] += 1;
+                table[_mm_extract_epi32(lo, 2)] += 1;
+                table[_mm_extract_epi32(lo, 3)] += 1;
+                table[_mm_cvtsi128_si32(hi)] += 1;
+                table[_mm_extract_epi32(hi, 1)] += 1;
+                table[_mm_extract_epi32(hi, 2)] += 1;
+                table[_mm_extract_epi32(hi, 3)] += 1;
+            }
+            else
+            {
+                __m256i const index = _mm256_add_epi64(digit, lane_offsets);
+                __m128i const lo = _mm256_castsi256_si128(index);
+                __m128i const hi = _mm256_extracti128_si256(index, 1);
+                table[_mm_cvtsi128_si64(lo)] += 1;
+                table[_mm_extract_epi64(lo, 1)] += 1;
+                table[_mm_cvtsi128_si64(hi)] += 1;
+                table[_mm_extract_epi64(hi, 1)] += 1;
+            }
+        }
+    }
+    count_lanes_scalar<Base>(data + i, size - i, key, powers, digits, Lanes, tables);
+}
+
+// GCC's AVX-512 intrinsics start from _mm512_undefined, which it then warns of.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template <typename T, typename Key>
+RADIX_SORT_TARGET("avx512f,avx512vl")
+inline __m512i key_avx512(__m512i x, Key const & key)
+{
+    __m512i k;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if constexpr (sizeof(T) == 4)
+            k = _mm512_xor_si512(x, _mm512_or_si512(_mm512_srai_epi32(x, 31), _mm512_set1_epi32(INT32_MIN)));
+        else
+            k = _mm512_xor_si512(x, _mm512_or_si512(_mm512_srai_epi64(x, 63), _mm512_set1_epi64(INT64_MIN)));
+    }
+    else if constexpr (sizeof(T) == 4)
+    {
+        k = _mm512_xor_si512(x, _mm512_set1_epi32(static_cast<int32_t>(key.mask)));
+    }
+    else
+    {
+        k = _mm512_xor_si512(x, _mm512_set1_epi64(static_cast<int64_t>(key.mask)));
+    }
+    if constexpr (sizeof(T) == 4)
+        return _mm512_sub_epi32(k, _mm512_set1_epi32(static_cast<int32_t>(key.offset)));
+    else
+        return _mm512_sub_epi64(k, _mm512_set1_epi64(static_cast<int64_t>(key.offset)));
+}
+
+// Each lane has its own table, so the indices of one vector never collide,
+// and the counts can be gathered, incremented, and scattered without conflict detection.
+// Only for 4 byte T. With 8 byte T, a vector is only 8 lanes, and the
+// gather and scatter measured slower than AVX2's 4 extracts and increments.
+template <size_t Base, typename T, typename Key, typename Power>
+RADIX_SORT_TARGET("avx512f,avx512vl")
+void count_lanes_avx512(T const * data, size_t size, Key const & key, Power const * powers, size_t digits, uint32_t* tables)
+{
+    static_assert(sizeof(T) == 4);
+    constexpr size_t Lanes = 16;
+    auto* const counts = reinterpret_cast<int*>(tables);
+    __m512i const mask = _mm512_set1_epi32(Base - 1);
+    __m512i const lane_offsets = _mm512_mullo_epi32(
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(static_cast<int>(digits * Base)));
+    __m512i const one = _mm512_set1_epi32(1);
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m512i const k = key_avx512<T>(_mm512_loadu_si512(data + i), key);
+        for (size_t d = 0; d < digits; ++d)
+        {
+            __m128i const shift = _mm_cvtsi32_si128(static_cast<int>(powers[d]));
+            __m512i const digit = _mm512_and_si512(_mm512_srl_epi32(k, shift), mask);
+            __m512i const index = _mm512_add_epi32(lane_offsets, _mm512_add_epi32(digit, _mm512_set1_epi32(static_cast<int>(d * Base))));
+            __m512i const count = _mm512_i32gather_epi32(index, counts, 4);
+            _mm512_i32scatter_epi32(counts, index, _mm512_add_epi32(count, one), 4);
+        }
+    }
+    count_lanes_scalar<Base>(data + i, size - i, key, powers, digits, Lanes, tables);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+// Add the counts of every element's digit at each of powers to counts[d],
+// for d in [0, digits). This is the counting pass of the sorts, for one digit
+// (RadixSorter::histogram) or all of them at once (count_digits).
+//
+// Small inputs use the plain loop, since the tables cost more to clear
+// and sum than the elements cost to count.
+//
+// level is for tests and benchmarks, and must be at most simd_level().
+template <size_t Base, typename T, typename Key, typename Power>
+void count_digits_into(T const * data, size_t size, Key const & key, Power const * powers, size_t digits,
+    std::array<size_t, Base>* counts, SimdLevel level = simd_level())
+{
+    constexpr size_t MinSize = 2048;
+
+    if (size < MinSize || Base > 256)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto const k = key(data[i]);
+            for (size_t d = 0; d < digits; ++d)
+                counts[d][digit_of<Base>(k, powers[d])] += 1;
+        }
+        return;
+    }
+
+    // Keys and digits can be computed a vector at a time for
+    // 4 and 8 byte numbers, sorted as themselves, by power of two Base.
+    constexpr bool Vector = is_power_of_two<Base> && (sizeof(T) == 4 || sizeof(T) == 8) &&
+        std::is_arithmetic_v<T> && std::is_same_v<Key, ProjectedKey<T, Identity>>;
+
+    if (!Vector)
+        level = SimdLevel::Scalar;
+    if (level == SimdLevel::Avx512 && sizeof(T) != 4)
+        level = SimdLevel::Avx2;
+    if (level == SimdLevel::Sse42 && sizeof(T) != 4)
+        level = SimdLevel::Scalar;
+    size_t const lanes = (level == SimdLevel::Avx512) ? 16 : (level == SimdLevel::Avx2) ? 32 / sizeof(T) : 4;
+
+    thread_local std::vector<uint32_t> tables;
+    tables.assign(lanes * digits * Base, 0);
+
+    // Blocks small enough that no 32 bit count overflows.
+    size_t const Block = size_t(1) << 30;
+    for (size_t first = 0; first < size; first += Block)
+    {
+        size_t const n = std::min(Block, size - first);
+#if RADIX_SORT_X86_DISPATCH
+        if constexpr (Vector)
+        {
+            // Avx512 and Sse42 here are only for 4 byte T, see above.
+            if (level == SimdLevel::Avx2)
+                count_lanes_avx2<Base>(data + first, n, key, powers, digits, tables.data());
+            else if (level == SimdLevel::Scalar)
+                count_lanes_scalar<Base>(data + first, n, key, powers, digits, lanes, tables.data());
+            else if constexpr (sizeof(T) == 4)
+            {
+                if (level == SimdLevel::Avx512)
+                    count_lanes_avx512<Base>(data + first, n, key, powers, digits, tables.data());
+                else
+                    count_lanes_sse42<Base>(data + first, n, key, powers, digits, tables.data());
+            }
+            else
+                count_lanes_scalar<Base>(data + first, n, key, powers, digits, lanes, tables.data());
+        }
+        else
+#endif
+        {
+            count_lanes_scalar<Base>(data + first, n, key, powers, digits, lanes, tables.data());
+        }
+
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            for (size_t d = 0; d < digits; ++d)
+            {
+                uint32_t* const table = &tables[(lane * digits + d) * Base];
+                for (size_t b = 0; b < Base; ++b)
+                {
+                    counts[d][b] += table[b];
+                    table[b] = 0;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,292 @@
+//
+// radix_sort_stats.h
+//
+// The pass before sorting: choose the key, and find the min, max, bitwise OR
+// and bitwise AND of all the keys, optionally copying the input at the same time.
+//
+// Copying the input, then finding min, then max, is three reads of it before
+// the first histogram. This is one, and for 4 and 8 byte numbers, a vector at
+// a time, see radix_sort_dispatch.h. Min and max size the digits. OR and AND
+// give the bits that vary, the bits set in some key but not all. See rebase_key.
+//
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include "radix_sort_common.h"
+#include "radix_sort_dispatch.h"
+#include "radix_sort_histogram.h"
+
+// Statistics of a set of keys. A key with a bit in bit_or but not in bit_and varies.
+template <typename K>
+struct KeyStats
+{
+    K min = static_cast<K>(~K(0));
+    K max = 0;
+    K bit_or = 0;
+    K bit_and = static_cast<K>(~K(0));
+
+    void add(K k)
+    {
+        min = std::min(min, k);
+        max = std::max(max, k);
+        bit_or |= k;
+        bit_and &= k;
+    }
+
+    void add(KeyStats const & other)
+    {
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        bit_or |= other.bit_or;
+        bit_and &= other.bit_and;
+    }
+};
+
+// Add keys of in to stats, and copy in to out, if Copy.
+template <bool Copy, typename T, typename Key>
+void key_stats_scalar(T const * in, size_t size, T* out, Key const & key, KeyStats<typename Key::type>& stats)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        T const value = in[i];
+        if constexpr (Copy)
+            out[i] = value;
+        stats.add(key(value));
+    }
+}
+
+#if RADIX_SORT_X86_DISPATCH
+
+// The vector kernels keep a min, max, OR and AND per lane, and combine the
+// lanes at the end. Below AVX-512, there is no unsigned 64 bit compare,
+// so 64 bit keys are compared signed with the sign bit flipped.
+
+template <bool Copy, typename T, typename Key>
+RADIX_SORT_TARGET("sse4.2")
+void key_stats_sse42(T const * in, size_t size, T* out, Key const & key, KeyStats<typename Key::type>& stats)
+{
+    using K = typename Key::type;
+    constexpr size_t Lanes = 16 / sizeof(T);
+    __m128i const bias = (sizeof(T) == 4) ? _mm_setzero_si128() : _mm_set1_epi64x(INT64_MIN);
+    __m128i min = (sizeof(T) == 4) ? _mm_set1_epi64x(-1) : _mm_set1_epi64x(INT64_MAX);
+    __m128i max = (sizeof(T) == 4) ? _mm_setzero_si128() : bias;
+    __m128i bit_or = _mm_setzero_si128();
+    __m128i bit_and = _mm_set1_epi64x(-1);
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i));
+        if constexpr (Copy)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x);
+        __m128i const k = key_sse42<T>(x, key);
+        bit_or = _mm_or_si128(bit_or, k);
+        bit_and = _mm_and_si128(bit_and, k);
+        if constexpr (sizeof(T) == 4)
+        {
+            min = _mm_min_epu32(min, k);
+            max = _mm_max_epu32(max, k);
+        }
+        else
+        {
+            __m128i const b = _mm_xor_si128(k, bias);
+            min = _mm_blendv_epi8(min, b, _mm_cmpgt_epi64(min, b));
+            max = _mm_blendv_epi8(max, b, _mm_cmpgt_epi64(b, max));
+        }
+    }
+
+    alignas(16) K lanes[4][Lanes];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes[0]), _mm_xor_si128(min, bias));
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes[1]), _mm_xor_si128(max, bias));
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes[2]), bit_or);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes[3]), bit_and);
+    for (size_t lane = 0; lane < Lanes; ++lane)
+        stats.add(KeyStats<K>{lanes[0][lane], lanes[1][lane], lanes[2][lane], lanes[3][lane]});
+
+    key_stats_scalar<Copy>(in + i, size - i, out + (Copy ? i : 0), key, stats);
+}
+
+template <bool Copy, typename T, typename Key>
+RADIX_SORT_TARGET("avx2")
+void key_stats_avx2(T const * in, size_t size, T* out, Key const & key, KeyStats<typename Key::type>& stats)
+{
+    using K = typename Key::type;
+    constexpr size_t Lanes = 32 / sizeof(T);
+    __m256i const bias = (sizeof(T) == 4) ? _mm256_setzero_si256() : _mm256_set1_epi64x(INT64_MIN);
+    __m256i min = (sizeof(T) == 4) ? _mm256_set1_epi64x(-1) : _mm256_set1_epi64x(INT64_MAX);
+    __m256i max = (sizeof(T) == 4) ? _mm256_setzero_si256() : bias;
+    __m256i bit_or = _mm256_setzero_si256();
+    __m256i bit_and = _mm256_set1_epi64x(-1);
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m256i const x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i));
+        if constexpr (Copy)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), x);
+        __m256i const k = key_avx2<T>(x, key);
+        bit_or = _mm256_or_si256(bit_or, k);
+        bit_and = _mm256_and_si256(bit_and, k);
+        if constexpr (sizeof(T) == 4)
+        {
+            min = _mm256_min_epu32(min, k);
+            max = _mm256_max_epu32(max, k);
+        }
+        else
+        {
+            __m256i const b = _mm256_xor_si256(k, bias);
+            min = _mm256_blendv_epi8(min, b, _mm256_cmpgt_epi64(min, b));
+            max = _mm256_blendv_epi8(max, b, _mm256_cmpgt_epi64(b, max));
+        }
+    }
+
+    alignas(32) K lanes[4][Lanes];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[0]), _mm256_xor_si256(min, bias));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[1]), _mm256_xor_si256(max, bias));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[2]), bit_or);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[3]), bit_and);
+    for (size_t lane = 0; lane < Lanes; ++lane)
+        stats.add(KeyStats<K>{lanes[0][lane], lanes[1][lane], lanes[2][lane], lanes[3][lane]});
+
+    key_stats_scalar<Copy>(in + i, size - i, out + (Copy ? i : 0), key, stats);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template <bool Copy, typename T, typename Key>
+RADIX_SORT_TARGET("avx512f,avx512vl")
+void key_stats_avx512(T const * in, size_t size, T* out, Key const & key, KeyStats<typename Key::type>& stats)
+{
+    using K = typename Key::type;
+    constexpr size_t Lanes = 64 / sizeof(T);
+    __m512i min = _mm512_set1_epi64(-1);
+    __m512i max = _mm512_setzero_si512();
+    __m512i bit_or = _mm512_setzero_si512();
+    __m512i bit_and = _mm512_set1_epi64(-1);
+
+    size_t i{};
+    for (; i + Lanes <= size; i += Lanes)
+    {
+        __m512i const x = _mm512_loadu_si512(in + i);
+        if constexpr (Copy)
+            _mm512_storeu_si512(out + i, x);
+        __m512i const k = key_avx512<T>(x, key);
+        bit_or = _mm512_or_si512(bit_or, k);
+        bit_and = _mm512_and_si512(bit_and, k);
+        if constexpr (sizeof(T) == 4)
+        {
+            min = _mm512_min_epu32(min, k);
+            max = _mm512_max_epu32(max, k);
+        }
+        else
+        {
+            min = _mm512_min_epu64(min, k);
+            max = _mm512_max_epu64(max, k);
+        }
+    }
+
+    alignas(64) K lanes[4][Lanes];
+    _mm512_store_si512(lanes[0], min);
+    _mm512_store_si512(lanes[1], max);
+    _mm512_store_si512(lanes[2], bit_or);
+    _mm512_store_si512(lanes[3], bit_and);
+    for (size_t lane = 0; lane < Lanes; ++lane)
+        stats.add(KeyStats<K>{lanes[0][lane], lanes[1][lane], lanes[2][lane], lanes[3][lane]});
+
+    key_stats_scalar<Copy>(in + i, size - i, out + (Copy ? i : 0), key, stats);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+template <bool Copy, typename T, typename Key>
+void key_stats(T const * in, size_t size, T* out, Key const & key, KeyStats<typename Key::type>& stats, SimdLevel level)
+{
+    constexpr bool Vector = (sizeof(T) == 4 || sizeof(T) == 8) &&
+        std::is_arithmetic_v<T> && std::is_same_v<Key, ProjectedKey<T, Identity>>;
+
+#if RADIX_SORT_X86_DISPATCH
+    if constexpr (Vector)
+    {
+        if (level == SimdLevel::Avx512)
+            return key_stats_avx512<Copy>(in, size, out, key, stats);
+        if (level == SimdLevel::Avx2)
+            return key_stats_avx2<Copy>(in, size, out, key, stats);
+        if (level == SimdLevel::Sse42)
+            return key_stats_sse42<Copy>(in, size, out, key, stats);
+    }
+#endif
+    key_stats_scalar<Copy>(in, size, out, key, stats);
+}
+
+// Choose the key for sorting in[0, size) by projection, and return it with
+// the statistics of every element's key. If out is not null, in is copied to it
+// in the same pass.
+//
+// Signed integers are keyed with the sign flipped, see SignFlipKey, and if
+// that shows there are no negatives, unflipped, by flipping the statistics.
+// Every key then has the bit, so that is only subtracting it.
+// Floats need no choice, and NaN does not compare, so keys are compared.
+//
+// level is for tests and benchmarks, and must be at most simd_level().
+template <typename T, typename Projection = Identity>
+auto get_key_stats(T const * in, size_t size, std::remove_const_t<T>* out = nullptr, Projection projection = Projection(),
+    SimdLevel level = simd_level())
+{
+    using Key = ProjectedKey<T, Projection>;
+    using K = typename Key::type;
+
+    Key const key(typename Key::Key(true), projection);
+    KeyStats<K> stats;
+    if (out)
+        key_stats<true>(in, size, out, key, stats, level);
+    else
+        key_stats<false>(in, size, out, key, stats, level);
+
+    if constexpr (!std::is_floating_point_v<projected_t<T, Projection>>)
+    {
+        K const sign = key.mask;
+        if (sign && stats.min >= sign)
+        {
+            stats.min ^= sign;
+            stats.max ^= sign;
+            stats.bit_or ^= sign;
+            stats.bit_and ^= sign;
+            return std::make_pair(Key(typename Key::Key(false), projection), stats);
+        }
+    }
+    return std::make_pair(key, stats);
+}
+
+// Range compression: key, with stats.min subtracted, and the largest key then, max - min.
+// Sorting needs only the digits of that, so a narrow range of large numbers,
+// like ids or timestamps, is as cheap as small numbers. Leading digits that are
+// the same for every key are zero after subtracting, and so not sorted at all.
+template <typename Key>
+std::pair<Key, typename Key::type> rebase_key(Key key, KeyStats<typename Key::type> const & stats)
+{
+    key.offset = stats.min;
+    return std::make_pair(key, static_cast<typename Key::type>(stats.max - stats.min));
+}
+
+// Choose the key for sorting [begin, end) by projection, and return it with the largest key.
+// The iterators must be contiguous.
+template <typename Iterator, typename Projection = Identity>
+auto get_radix_key(Iterator begin, Iterator end, Projection projection = Projection())
+{
+    using T = typename std::iterator_traits<Iterator>::value_type;
+    auto const size = static_cast<size_t>(end - begin);
+    auto const [key, stats] = get_key_stats<T>(size ? &*begin : nullptr, size, nullptr, projection);
+    return std::make_pair(key, stats.max);
+}
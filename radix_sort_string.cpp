@@ -0,0 +1,302 @@
+//
+// radix_sort_string.cpp
+//
+// MSD radix sort for strings, and other variable length byte keys.
+//
+// Like RadixSorter::helper, but the digits are bytes, the first byte first,
+// and a string's digit past its end is a bucket of its own, before
+// every byte. So Base is 257 and "ab" sorts before "ab\0" before "abc".
+// Strings in the end bucket are equal, and done.
+//
+// Strings are not moved while sorting. Each is an Item, a pointer, length
+// and original index, with the next 8 bytes of the string cached next to them.
+// Digits come from the cache, so the string is only read once per 8 levels,
+// instead of chasing the pointer for every digit. Items oscillate between
+// two arrays, like RadixSorter::helper. At the end the strings are
+// permuted once, by index.
+//
+// Small buckets are finished with multikey quicksort, i.e. 3-way partition
+// by the current byte, instead of a histogram of 257 counts.
+//
+// Strings are compared as unsigned bytes, like memcmp and std::string.
+// The sort is not stable, because multikey quicksort is not. Equal strings
+// can only be reordered among themselves.
+//
+// To test this code, see radix_sort.cpp.
+//
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <iterator>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The bytes of s, for the element types StringRadixSorter sorts.
+inline std::string_view string_bytes(std::string const & s)
+{
+    return s;
+}
+
+inline std::string_view string_bytes(std::string_view s)
+{
+    return s;
+}
+
+inline std::string_view string_bytes(std::pair<const char*, size_t> const & s)
+{
+    return std::string_view(s.first, s.second);
+}
+
+class StringRadixSorter
+{
+public:
+    // Buckets this small are finished with multikey quicksort.
+    size_t quicksortThreshold = 32;
+
+    // Statistic: how many scatters the last sort skipped, because every
+    // string in a bucket had the same byte, e.g. a common prefix like "http://".
+    size_t skippedPasses = 0;
+
+    // Sort [begin, end) in place. The elements are std::string, std::string_view,
+    // or (pointer, length) pairs, see string_bytes.
+    template <typename Iterator>
+    void operator()(Iterator begin, Iterator end)
+    {
+        using Value = typename std::iterator_traits<Iterator>::value_type;
+
+        skippedPasses = 0;
+
+        size_t const size = end - begin;
+        if (size < 2)
+            return;
+
+        std::vector<Item> data(size);
+        std::vector<Item> temp(size);
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto const bytes = string_bytes(begin[i]);
+            auto& item = data[i];
+            item.bytes = reinterpret_cast<const unsigned char*>(bytes.data());
+            item.size = bytes.size();
+            item.index = i;
+            fill_prefix(item, 0);
+        }
+
+        Item const * const sorted = helper(&data[0], &temp[0], size, 0, false) ? &temp[0] : &data[0];
+
+        // Permute the strings, once. std::string moves are cheap,
+        // and the rest are pairs of pointer and length.
+        std::vector<Value> values;
+        values.reserve(size);
+        for (size_t i = 0; i < size; ++i)
+            values.push_back(std::move(begin[sorted[i].index]));
+        std::move(values.begin(), values.end(), begin);
+    }
+
+private:
+    struct Item
+    {
+        // Bytes [depth & ~7, (depth & ~7) + 8) of the string, big endian,
+        // so the first byte is the most significant, zero past the end.
+        uint64_t prefix;
+        const unsigned char* bytes;
+        size_t size;
+        size_t index;
+    };
+
+    // Digits are 1 + byte, and 0 past the end of the string.
+    static constexpr size_t Base = 257;
+    using array = std::array<size_t, Base>;
+
+    // Cache 8 bytes of the string from depth, which is a multiple of 8.
+    static void fill_prefix(Item& item, size_t depth)
+    {
+        uint64_t prefix{};
+        size_t const end = std::min(item.size, depth + 8);
+        for (size_t i = depth; i < end; ++i)
+            prefix |= uint64_t(item.bytes[i]) << (56 - 8 * (i - depth));
+        item.prefix = prefix;
+    }
+
+    static size_t get_digit(Item const & item, size_t depth)
+    {
+        if (depth >= item.size)
+            return 0;
+        return 1 + size_t((item.prefix >> (56 - 8 * (depth & 7))) & 0xff);
+    }
+
+    // Go to the next byte. Every 8 bytes, refill the prefixes of the bucket.
+    static size_t next_depth(Item* data, size_t size, size_t depth)
+    {
+        depth += 1;
+        if ((depth & 7) == 0)
+        {
+            for (size_t i = 0; i < size; ++i)
+                fill_prefix(data[i], depth);
+        }
+        return depth;
+    }
+
+    // Sort data, whose first depth bytes are all equal.
+    // The result goes in temp if result_in_temp, else in data.
+    // Return result_in_temp, for the caller's convenience.
+    bool helper(Item* data, Item* temp, size_t size, size_t depth, bool result_in_temp)
+    {
+        if (size <= quicksortThreshold)
+        {
+            if (result_in_temp)
+            {
+                std::copy(data, data + size, temp);
+                data = temp;
+            }
+            multikey_quicksort(data, size, depth);
+            return result_in_temp;
+        }
+
+        array counts{};
+        size_t i{};
+
+        // A common prefix, e.g. of URLs or paths, is skipped without scattering,
+        // in a loop instead of recursion, so long prefixes do not use stack.
+        while (true)
+        {
+            counts = array{};
+            for (i = 0; i < size; ++i)
+                counts[get_digit(data[i], depth)] += 1;
+
+            size_t const digit = get_digit(data[0], depth);
+            if (counts[digit] != size)
+                break;
+
+            // Every string ended, so they are all equal.
+            if (digit == 0)
+            {
+                if (result_in_temp)
+                    std::copy(data, data + size, temp);
+                return result_in_temp;
+            }
+
+            skippedPasses += 1;
+            depth = next_depth(data, size, depth);
+        }
+
+        array positions{};
+        size_t position{};
+
+        for (i = 0; i < Base; ++i)
+        {
+            positions[i] = position;
+            position += counts[i];
+        }
+
+        {
+            auto current_position = positions;
+            for (i = 0; i < size; ++i)
+                temp[current_position[get_digit(data[i], depth)]++] = data[i];
+        }
+
+        // The strings that ended are done, and equal. They are now in temp.
+        if (!result_in_temp)
+            std::copy(temp, temp + counts[0], data);
+
+        for (i = 1; i < Base; ++i)
+        {
+            auto const count = counts[i];
+            if (!count)
+                continue;
+
+            Item* const bucket = temp + positions[i];
+            helper(bucket, data + positions[i], count, next_depth(bucket, count, depth), !result_in_temp);
+        }
+        return result_in_temp;
+    }
+
+    // Bentley and Sedgewick's multikey quicksort: partition by the byte
+    // at depth into less, equal and greater. Less and greater are sorted at the
+    // same depth, and equal at the next depth, unless the strings ended.
+    void multikey_quicksort(Item* data, size_t size, size_t depth)
+    {
+        while (size > 1)
+        {
+            if (size <= 8)
+            {
+                insertion_sort(data, size, depth);
+                return;
+            }
+
+            size_t const pivot = median_digit(data, size, depth);
+
+            // Dijkstra's 3-way partition:
+            // [0, lt) less, [lt, i) equal, [i, gt) unknown, [gt, size) greater.
+            size_t lt{};
+            size_t i{};
+            size_t gt{size};
+            while (i < gt)
+            {
+                size_t const digit = get_digit(data[i], depth);
+                if (digit < pivot)
+                    std::swap(data[lt++], data[i++]);
+                else if (digit > pivot)
+                    std::swap(data[i], data[--gt]);
+                else
+                    ++i;
+            }
+
+            multikey_quicksort(data, lt, depth);
+            if (pivot)
+                multikey_quicksort(data + lt, gt - lt, next_depth(data + lt, gt - lt, depth));
+
+            // Loop on greater, instead of recursing.
+            data += gt;
+            size -= gt;
+        }
+    }
+
+    size_t median_digit(Item const * data, size_t size, size_t depth)
+    {
+        size_t a = get_digit(data[0], depth);
+        size_t b = get_digit(data[size / 2], depth);
+        size_t c = get_digit(data[size - 1], depth);
+        if (a > b)
+            std::swap(a, b);
+        if (b > c)
+            std::swap(b, c);
+        return std::max(a, b);
+    }
+
+    // Compare the strings from depth on. The prefix compares the next
+    // bytes, up to 8, at once, then the rest of the strings are compared.
+    static bool less(Item const & a, Item const & b, size_t depth)
+    {
+        // Bytes before depth within the prefix are equal, so compare whole prefixes.
+        if (a.prefix != b.prefix)
+            return a.prefix < b.prefix;
+        size_t const next = (depth & ~size_t(7)) + 8;
+        if (a.size <= next || b.size <= next)
+            return a.size < b.size;
+        size_t const n = std::min(a.size, b.size) - next;
+        int const c = memcmp(a.bytes + next, b.bytes + next, n);
+        return c ? (c < 0) : (a.size < b.size);
+    }
+
+    static void insertion_sort(Item* data, size_t size, size_t depth)
+    {
+        for (size_t i = 1; i < size; ++i)
+        {
+            Item const item = data[i];
+            size_t j = i;
+            while (j > 0 && less(item, data[j - 1], depth))
+            {
+                data[j] = data[j - 1];
+                --j;
+            }
+            data[j] = item;
+        }
+    }
+};
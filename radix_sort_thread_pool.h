@@ -0,0 +1,252 @@
+//
+// radix_sort_thread_pool.h
+//
+// A small work-stealing thread pool, for the parallel sorts.
+//
+// Each worker has its own queue of tasks. A worker runs its own tasks
+// newest first, which is depth first for recursive work, and keeps
+// the working set in cache. When its own queue is empty, it steals
+// the oldest task from another queue, which for recursive work tends to be
+// the largest remaining piece.
+//
+// Threads that are not workers, i.e. the caller of a sort, share one more
+// queue, and help run tasks while they wait for them. With nothing to run,
+// waiters sleep, like idle workers, until a task is queued or their group is done.
+//
+// A task that throws does not stop its group. The first exception is kept,
+// and rethrown by wait, once every task of the group is done.
+//
+// On Posix, compile with -pthread.
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Tasks are spawned into a group, and the group is waited on.
+struct TaskGroup
+{
+    std::atomic<size_t> pending{0};
+
+    // The first exception a task threw, for wait to rethrow.
+    std::mutex mutex;
+    std::exception_ptr exception;
+};
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+    {
+        if (threads < 1)
+            threads = 1;
+
+        // One queue per worker, and one shared by non-worker threads.
+        for (unsigned i = 0; i <= threads; ++i)
+            queues.emplace_back(new Queue());
+
+        for (unsigned i = 0; i < threads; ++i)
+            workers.emplace_back([this, i] { worker(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& thread : workers)
+            thread.join();
+    }
+
+    // The pool used by RadixSorter and radix_sort, created on first use,
+    // with a worker per hardware thread.
+    static ThreadPool& instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // Number of threads that run tasks, including a waiting caller.
+    size_t concurrency() const { return workers.size() + 1; }
+
+    // Queue f to run on some thread, as part of group.
+    void spawn(TaskGroup& group, std::function<void()> f)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& queue = *queues[self()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.emplace_back([this, &group, f = std::move(f)]
+            {
+                run_in(group, f);
+                finish(group);
+            });
+        }
+        queued.fetch_add(1, std::memory_order_release);
+
+        // Taking the lock orders this with a worker deciding to sleep,
+        // so the notification is not lost.
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_one();
+    }
+
+    // Run tasks until every task in group, including tasks they spawn, is done,
+    // then rethrow the first exception any of them threw.
+    void wait(TaskGroup& group)
+    {
+        size_t const index = self();
+        while (group.pending.load(std::memory_order_acquire))
+        {
+            if (run_one(index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&]
+            {
+                return !group.pending.load(std::memory_order_acquire) || queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+
+        if (group.exception)
+            std::rethrow_exception(std::exchange(group.exception, nullptr));
+    }
+
+    // Call f here, as part of group, then wait for group. Tasks f spawned
+    // are waited for even if f throws, since they may refer to its caller.
+    template <typename F>
+    void run(TaskGroup& group, F const & f)
+    {
+        run_in(group, f);
+        wait(group);
+    }
+
+    // Call f(i) for i in [0, n), in parallel, and wait.
+    template <typename F>
+    void parallel_for(size_t n, F f)
+    {
+        TaskGroup group;
+        for (size_t i = 1; i < n; ++i)
+            spawn(group, [&f, i] { f(i); });
+        run(group, [&] { if (n) f(0); });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stop = false;
+
+    // Which pool the current thread is a worker of, and its queue.
+    static thread_local ThreadPool* worker_pool;
+    static thread_local size_t worker_index;
+
+    size_t self() const
+    {
+        return (worker_pool == this) ? worker_index : workers.size();
+    }
+
+    // Call f, keeping what it throws in group, if group has no exception yet.
+    template <typename F>
+    static void run_in(TaskGroup& group, F const & f)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(group.mutex);
+            if (!group.exception)
+                group.exception = std::current_exception();
+        }
+    }
+
+    // A task of group is done. The last one wakes whoever waits for group.
+    // group may be gone as soon as pending is 0, so it is not touched after.
+    void finish(TaskGroup& group)
+    {
+        if (group.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        // As in spawn, the lock orders this with a waiter deciding to sleep.
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_all();
+    }
+
+    // Run one task, from our own queue (newest), else stolen from
+    // another queue (oldest). Return false if there was none.
+    bool run_one(size_t index)
+    {
+        std::function<void()> task;
+        size_t const n = queues.size();
+
+        for (size_t i = 0; i < n && !task; ++i)
+        {
+            Queue& queue = *queues[(index + i) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+
+        if (!task)
+            return false;
+
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        return true;
+    }
+
+    void worker(size_t index)
+    {
+        worker_pool = this;
+        worker_index = index;
+
+        while (true)
+        {
+            if (run_one(index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (stop)
+                return;
+            wake.wait(lock, [this] { return stop || queued.load(std::memory_order_acquire) > 0; });
+            if (stop)
+                return;
+        }
+    }
+};
+
+inline thread_local ThreadPool* ThreadPool::worker_pool;
+inline thread_local size_t ThreadPool::worker_index;